@@ -2,21 +2,38 @@
 #include <stdlib.h>
 #include <cstdlib>
 #include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #ifdef WIN32
 	#include <windows.h>
 	#include <windowsx.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define XEDIT_SSE2
+	#include <emmintrin.h>
+#endif
+
 #ifdef __linux__
 	#include <sys/time.h>
+	#include <sys/select.h>
 	#include <sys/ipc.h>
 	#include <sys/shm.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 
 	#include <X11/Xlib.h>
 	#include <X11/Xatom.h>
 	#include <X11/Xutil.h>
 	#include <X11/extensions/XShm.h>
+	#ifdef XEDIT_LATENCY
+		#include <X11/extensions/XTest.h>
+	#endif
 	
 	#define VK_LEFT		113
 	#define VK_UP		111
@@ -25,6 +42,21 @@
 	#define	VK_BACK		22
 #endif
 
+double getTime() {
+#ifdef WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#endif
+
+#ifdef __linux__
+	timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec * 0.000001;
+#endif
+}
+
 void convertFont(const char *inName, const char *outName) {
 	FILE *f = fopen(inName, "rb");
 	fseek(f, 0, SEEK_END);
@@ -80,22 +112,62 @@ void convertFont(const char *inName, const char *outName) {
 	printf("convert %s -> %s\n", inName, outName);
 }
 
-#ifdef WIN32
-	typedef unsigned int Color;
-#endif
+// 0xRRGGBB, converted to the pixels of the screen where glyphs are drawn
+typedef unsigned int Color;
 
-#ifdef __linux__
-	typedef unsigned int Color;
-#endif
+#define COLOR_CLEAR	0xFF000000	// background that leaves the pixels below as they are
+
+// pixel layouts of the screen, the canvas picks one when it's made and the drawing code is compiled for each
+enum PixelFormat {
+	FORMAT_32,	// 8:8:8 in 32 bits, depth 24 and 32
+	FORMAT_24,	// 8:8:8 packed into 3 bytes
+	FORMAT_16,	// 5:6:5
+	FORMAT_15,	// 5:5:5
+	FORMAT_MAX
+};
 
-Color toColor(unsigned int x) {
-	if (sizeof(Color) == 4)
-		return x;
-	if (sizeof(Color) == 2)
-		return (x & 0xF80000) >> 8 | (x & 0xFC00) >> 5 | (x & 0xFF) >> 3;
+struct Format32 {
+	typedef unsigned int Pixel;
+	static Pixel pack(Color c) { return c; }
+};
+
+struct Pixel24 {
+	unsigned char b, g, r;
+};
+
+struct Format24 {
+	typedef Pixel24 Pixel;
+	static Pixel pack(Color c) {
+		Pixel p = { (unsigned char)c, (unsigned char)(c >> 8), (unsigned char)(c >> 16) };
+		return p;
+	}
+};
+
+struct Format16 {
+	typedef unsigned short Pixel;
+	static Pixel pack(Color c) { return (Pixel)((c & 0xF80000) >> 8 | (c & 0xFC00) >> 5 | (c & 0xFF) >> 3); }
+};
+
+struct Format15 {
+	typedef unsigned short Pixel;
+	static Pixel pack(Color c) { return (Pixel)((c & 0xF80000) >> 9 | (c & 0xF800) >> 6 | (c & 0xFF) >> 3); }
+};
+
+int pixelSize(PixelFormat format) {
+	static const int sizes[FORMAT_MAX] = { 4, 3, 2, 2 };
+	return sizes[format];
+}
+
+const char* formatName(PixelFormat format) {
+	static const char *names[FORMAT_MAX] = { "32", "24", "16", "15" };
+	return names[format];
 }
 
-#define COLOR_CLEAR	toColor(0xFF000000)
+// the pixel a number of bytes further on, rows of packed 24 bit pixels aren't a whole number of pixels apart
+template <class P>
+P* advance(P *pixel, int bytes) {
+	return (P*)((char*)pixel + bytes);
+}
 
 struct Point {
 	int x, y;
@@ -110,7 +182,8 @@ struct Rect {
 };
 
 struct BitFont {
-	unsigned char *data;
+	unsigned char	*data;
+	unsigned short	rows[256 * 16];	// 9 pixel wide glyph rows, box drawing characters repeat the 8th column in the 9th
 
 	BitFont(const char *name) {
 		FILE *f = fopen(name, "rb");
@@ -118,765 +191,5890 @@ struct BitFont {
 		data = new unsigned char[rows];
 		fread(data, sizeof(data[0]), rows, f);
 		fclose(f);
+
+		for (int i = 0; i < rows; i++) {
+			int c = i / 16;
+			this->rows[i] = data[i] | ((c >= 0xC0 && c <= 0xDF) ? (data[i] >> 7) << 8 : 0);
+		}
 	}
 
 	~BitFont() {
 		delete[] data;
 	}
 
-	void putChar(unsigned char c, Color fColor, Color bColor, Color *pixel, int stride) {
-		unsigned char *d = &data[c * 16];
+	// the stride is in bytes, the fastest kernel for the format is picked at compile time
+	template <class F>
+	void putChar(unsigned char c, Color fColor, Color bColor, typename F::Pixel *pixel, int stride) {
+	#ifdef XEDIT_SSE2
+		putCharSSE2(F(), c, fColor, bColor, pixel, stride);
+	#else
+		putCharScalar<F>(c, fColor, bColor, pixel, stride);
+	#endif
+	}
 
-		for (int y = 0; y < 16; y++) {
-			unsigned char v = d[y];
+	// for the few glyphs drawn outside the rasterizer, where the format is only known at run time
+	void putChar(PixelFormat format, unsigned char c, Color fColor, Color bColor, char *pixel, int stride) {
+		switch (format) {
+		case FORMAT_32:	putChar<Format32>(c, fColor, bColor, (Format32::Pixel*)pixel, stride);	break;
+		case FORMAT_24:	putChar<Format24>(c, fColor, bColor, (Format24::Pixel*)pixel, stride);	break;
+		case FORMAT_16:	putChar<Format16>(c, fColor, bColor, (Format16::Pixel*)pixel, stride);	break;
+		case FORMAT_15:	putChar<Format15>(c, fColor, bColor, (Format15::Pixel*)pixel, stride);	break;
+		default:		break;
+		}
+	}
 
-			for (int x = 0; x < 9; x++) {
-				if (x == 8 && c >= 0xC0 && c <= 0xDF)
-					v = d[y] >> 7;
+	template <class F>
+	void putCharScalar(unsigned char c, Color fColor, Color bColor, typename F::Pixel *pixel, int stride) {
+		typedef typename F::Pixel Pixel;
+		const unsigned short *row = &rows[c * 16];
+		Pixel f = F::pack(fColor);
 
-				if (v & 1)
-					pixel[x] = fColor;
-				else
-					if (bColor != COLOR_CLEAR)
-						pixel[x] = bColor;
-				v >>= 1;
+		if (bColor == COLOR_CLEAR) {
+			for (int y = 0; y < 16; y++) {
+				for (int x = 0; x < 9; x++)
+					if ((row[y] >> x) & 1)
+						pixel[x] = f;
+				pixel = advance(pixel, stride);
 			}
+			return;
+		}
 
-			pixel = &pixel[stride];
+		Pixel color[2] = { F::pack(bColor), f };
+		for (int y = 0; y < 16; y++) {
+			unsigned int v = row[y];
+			for (int x = 0; x < 9; x++)
+				pixel[x] = color[(v >> x) & 1];
+			pixel = advance(pixel, stride);
 		}
 	}
-};
-
-struct Canvas {
-	int		width, height;
-	int		stride;
-	Color	*pixels;
-	Rect	rect;
-	
-#ifdef __linux__
-	XShmSegmentInfo	shminfo;
-	GC		gc;
-	Display	*display;
-	XImage	*image;
 
-	Canvas(Display *display) : width(0), height(0), pixels(NULL), display(display), image(NULL) {
-		int i;
-		if (!XQueryExtension(display, "MIT-SHM", &i, &i, &i))
-			printf("SHM is not supported\n");
-		gc = DefaultGC(display, DefaultScreen(display));
+#ifdef XEDIT_SSE2
+	// expands 4 bits of a glyph row into 4 pixel masks
+	static const __m128i* mask(unsigned int bits) {
+		static const unsigned int masks[16][4] = {
+			{ 0, 0, 0, 0 }, { ~0U, 0, 0, 0 }, { 0, ~0U, 0, 0 }, { ~0U, ~0U, 0, 0 },
+			{ 0, 0, ~0U, 0 }, { ~0U, 0, ~0U, 0 }, { 0, ~0U, ~0U, 0 }, { ~0U, ~0U, ~0U, 0 },
+			{ 0, 0, 0, ~0U }, { ~0U, 0, 0, ~0U }, { 0, ~0U, 0, ~0U }, { ~0U, ~0U, 0, ~0U },
+			{ 0, 0, ~0U, ~0U }, { ~0U, 0, ~0U, ~0U }, { 0, ~0U, ~0U, ~0U }, { ~0U, ~0U, ~0U, ~0U },
+		};
+		return (const __m128i*)masks[bits & 15];
 	}
-#endif
 
-#ifdef WIN32
-	Canvas() : width(0), height(0), pixels(NULL) {}
-#endif
+	static __m128i blend(const __m128i &mask, const __m128i &f, const __m128i &b) {
+		return _mm_or_si128(_mm_and_si128(mask, f), _mm_andnot_si128(mask, b));
+	}
 
-	~Canvas() {
-		resize(0, 0);
+	// formats without a vector kernel
+	template <class F>
+	void putCharSSE2(F, unsigned char c, Color fColor, Color bColor, typename F::Pixel *pixel, int stride) {
+		putCharScalar<F>(c, fColor, bColor, pixel, stride);
 	}
 
-	void resize(int width, int height) {
-		if (this->width != width || this->height != height) {
-			printf("resize %d %d\n", width, height);
+	// 32 bit pixels, two vectors of four and the 9th column
+	void putCharSSE2(Format32, unsigned char c, Color fColor, Color bColor, unsigned int *pixel, int stride) {
+		const unsigned short *row = &rows[c * 16];
+		__m128i f = _mm_set1_epi32(fColor);
 
-			this->width = width;
-			this->height = height;
-		#ifdef WIN32
-			pixels = (Color*)realloc(pixels, width * height * 4);
-			stride = width;
-		#endif
-		
-		#ifdef __linux__
-			if (image) {
-				XShmDetach(display, &shminfo);
-				XDestroyImage(image);
-				shmdt(shminfo.shmaddr);
+		if (bColor == COLOR_CLEAR) {
+			for (int y = 0; y < 16; y++) {
+				unsigned int v = row[y];
+				__m128i *p = (__m128i*)pixel;
+				_mm_storeu_si128(p + 0, blend(_mm_loadu_si128(mask(v)), f, _mm_loadu_si128(p + 0)));
+				_mm_storeu_si128(p + 1, blend(_mm_loadu_si128(mask(v >> 4)), f, _mm_loadu_si128(p + 1)));
+				if (v & 0x100)
+					pixel[8] = fColor;
+				pixel = advance(pixel, stride);
 			}
-			
-			if (!width || !height)
-				return;
-				
-			int depth = DefaultDepth(display, DefaultScreen(display));
-			printf("color depth:# %d\n", depth);
+			return;
+		}
+
+		__m128i b = _mm_set1_epi32(bColor);
+		for (int y = 0; y < 16; y++) {
+			unsigned int v = row[y];
+			__m128i *p = (__m128i*)pixel;
+			_mm_storeu_si128(p + 0, blend(_mm_loadu_si128(mask(v)), f, b));
+			_mm_storeu_si128(p + 1, blend(_mm_loadu_si128(mask(v >> 4)), f, b));
+			pixel[8] = (v & 0x100) ? fColor : bColor;
+			pixel = advance(pixel, stride);
+		}
+	}
 
-			image = XShmCreateImage(display, NULL, depth, ZPixmap, NULL, &shminfo, width, height);
+	void putCharSSE2(Format16, unsigned char c, Color fColor, Color bColor, unsigned short *pixel, int stride) {
+		putCharSSE2x16(c, Format16::pack(fColor), Format16::pack(bColor), bColor == COLOR_CLEAR, pixel, stride);
+	}
 
-			shminfo.shmid		= shmget(IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT|0777);
-			shminfo.shmaddr		= image->data = (char*)shmat(shminfo.shmid, 0, 0);
-			shminfo.readOnly	= false;
+	void putCharSSE2(Format15, unsigned char c, Color fColor, Color bColor, unsigned short *pixel, int stride) {
+		putCharSSE2x16(c, Format15::pack(fColor), Format15::pack(bColor), bColor == COLOR_CLEAR, pixel, stride);
+	}
 
-			XShmAttach(display, &shminfo);
-			XSync(display, false);
-			shmctl(shminfo.shmid, IPC_RMID, 0);
+	// 16 bit pixels, a row is one vector of eight and the 9th column, the lanes compare against their own bit
+	void putCharSSE2x16(unsigned char c, unsigned short fPixel, unsigned short bPixel, bool clear, unsigned short *pixel, int stride) {
+		const unsigned short *row = &rows[c * 16];
+		const __m128i bits = _mm_set_epi16(128, 64, 32, 16, 8, 4, 2, 1);
+		__m128i f = _mm_set1_epi16((short)fPixel);
+		__m128i b = _mm_set1_epi16((short)bPixel);
 
-			pixels = (Color*)image->data;
-			stride = image->bytes_per_line / sizeof(Color);
-		#endif
+		for (int y = 0; y < 16; y++) {
+			unsigned int v = row[y];
+			__m128i *p = (__m128i*)pixel;
+			__m128i m = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16((short)v), bits), bits);
+			if (clear) {
+				_mm_storeu_si128(p, blend(m, f, _mm_loadu_si128(p)));
+				if (v & 0x100)
+					pixel[8] = fPixel;
+			} else {
+				_mm_storeu_si128(p, blend(m, f, b));
+				pixel[8] = (v & 0x100) ? fPixel : bPixel;
+			}
+			pixel = advance(pixel, stride);
 		}
 	}
-	
-#ifdef WIN32
-	void present(HDC dc) {
-		if (rect.l > rect.r || rect.t > rect.b)
-			return;
-	//	RECT r = { 0, 0, width, height };
-	//	FillRect(dc, &r, (HBRUSH)GetStockObject(BLACK_BRUSH));
-		BITMAPINFO bmi = {sizeof(BITMAPINFOHEADER), width, -height, 1, 32, BI_RGB, 0, 0, 0, 0, 0};
-		SetDIBitsToDevice(dc, rect.l, rect.t, rect.r - rect.l, rect.b - rect.t, rect.l, rect.t, rect.t, rect.b, pixels, &bmi, 0);
-	//	SetDIBitsToDevice(dc, 0, 0, width, height, 0, 0, 0, height, pixels, &bmi, 0);
-	}
 #endif
+};
 
-#ifdef __linux__
-	void present(const Window &window) {
-		if (rect.l > rect.r || rect.t > rect.b)
-			return;
-		XShmPutImage(display, window, gc, image, rect.l, rect.t, rect.l, rect.t, rect.r - rect.l, rect.b - rect.t, false);
-		XFlush(display);
-		XSync(display, false);
+#define GLYPH_CACHE_BUDGET	(1024 * 1024)
+
+// rasterized glyph tiles keyed by (character, foreground, background), the least recently used ones get dropped
+struct GlyphCache {
+	struct Tile {
+		int		key;
+		int		chain;		// next tile in the same bucket
+		int		prev, next;	// usage order, head is the most recent
+		char	pixels[9 * 16 * 4];	// room for the widest format
+	} *tiles;
+
+	int		*buckets;
+	int		mask;
+	int		capacity, count;
+	int		head, tail;
+	int		hits, misses, evictions;
+
+	GlyphCache(int budget) : hits(0), misses(0), evictions(0) {
+		capacity = budget / sizeof(Tile);
+		if (capacity < 1) capacity = 1;
+		tiles = new Tile[capacity];
+
+		mask = 1;
+		while (mask < capacity * 2)
+			mask *= 2;
+		mask--;
+		buckets = new int[mask + 1];
+		clear();
 	}
-#endif
-	void scrollX(int delta) {
 
+	~GlyphCache() {
+		delete[] tiles;
+		delete[] buckets;
 	}
 
-	void scrollY(int offset) {
-		int size = width * (height - abs(offset)) * 4;
-		if (size <= 0) return;
+	void clear() {
+		count = 0;
+		head = tail = -1;
+		memset(buckets, -1, (mask + 1) * sizeof(int));
+	}
 
-		if (offset > 0)
-			memmove(&pixels[offset * width], &pixels[0], size);
-		else
-			memmove(&pixels[0], &pixels[-offset * width], size);
+	int bucket(int key) const {
+		return ((unsigned int)key * 2654435761U >> 8) & mask;
 	}
 
-	void fill(int x, int y, int w, int h, Color color) {
-		for (int j = y; j < y + h; j++)
-			for (int i = x; i < x + w; i++)
-				pixels[i + j * stride] = color;
-	};
-};
+	void unlink(int index) {
+		Tile &t = tiles[index];
+		if (t.prev != -1) tiles[t.prev].next = t.next; else head = t.next;
+		if (t.next != -1) tiles[t.next].prev = t.prev; else tail = t.prev;
+	}
 
-struct Editor {
-private:
-	BitFont	*font;
-	char	*text;
-	Point	cursor;
-	Point	scroll;
-	Point	offset;
-	bool	valid;
-public:
-	enum ThemeColor {
-		COLOR_CODE,
-		COLOR_TEXT,
-		COLOR_TYPE,
-		COLOR_DEFINE,
-		COLOR_NUMBER,
-		COLOR_OPCODE,
-		COLOR_COMMENT,
-		COLOR_ARGUMENT,
-		COLOR_BACK_LINE,
-		COLOR_BACK_NORMAL,
-		COLOR_BACK_SELECTION,
-		COLOR_BACK_SEARCH,
-		COLOR_CURSOR,
-		COLOR_MAX
-	};
+	void link(int index) {
+		Tile &t = tiles[index];
+		t.prev = -1;
+		t.next = head;
+		if (head != -1) tiles[head].prev = index;
+		head = index;
+		if (tail == -1) tail = index;
+	}
 
-	struct Theme {
-		union {
-			struct {
-				Color byID[COLOR_MAX];
-			};
-			struct {
-				Color code;
-				Color text;
-				Color type;
-				Color define;
-				Color number;
-				Color opcode;
-				Color comment;
-				Color argument;
-				Color back_line;
-				Color back_normal;
-				Color back_selection;
-				Color back_search;
-				Color cursor;
-			};
-		};
-	} theme;
+	// returns the tile pixels, 9 to a row, fresh tiles have to be rasterized by the caller
+	char* get(int key, bool &fresh) {
+		int *b = &buckets[bucket(key)];
+		for (int i = *b; i != -1; i = tiles[i].chain)
+			if (tiles[i].key == key) {
+				if (head != i) {
+					unlink(i);
+					link(i);
+				}
+				hits++;
+				fresh = false;
+				return tiles[i].pixels;
+			}
 
-	struct Syntax {
+		int i;
+		if (count < capacity)
+			i = count++;
+		else {
+			i = tail;
+			unlink(i);
+			int *p = &buckets[bucket(tiles[i].key)];
+			while (*p != i)
+				p = &tiles[*p].chain;
+			*p = tiles[i].chain;
+			evictions++;
+		}
 
-		struct Lexeme {
-			enum ID { 
-				ID_CODE, ID_TEXT, ID_TYPE, ID_DEFINE, ID_NUMBER, ID_OPCODE, ID_COMMENT, ID_ARGUMENT, ID_MAX = 0xFFFFFFFF
-			} id;
-			int	offset;
-			int	length;
-		} *lexeme;
-		int count;
+		tiles[i].key	= key;
+		tiles[i].chain	= *b;
+		*b = i;
+		link(i);
 
-		Syntax() : lexeme(NULL) {}
-		
-		~Syntax() { 
-			if (lexeme) free(lexeme);
+		misses++;
+		fresh = true;
+		return tiles[i].pixels;
+	}
+
+	template <class P>
+	static void draw(const P *tile, P *pixel, int stride) {
+		for (int y = 0; y < 16; y++) {
+			memcpy(pixel, &tile[y * 9], 9 * sizeof(P));
+			pixel = advance(pixel, stride);
 		}
+	}
+};
 
-		void lexemeBegin(int pos, Lexeme::ID id) {
-			if (count && !lexeme[count - 1].length)
-				return;
+#define RENDER_THREADS	0	// rasterizer threads, 0 picks one per core
 
-			lexeme = (Lexeme*)realloc(lexeme, (count + 1) * sizeof(Lexeme));
-			lexeme[count].id		= id;
-			lexeme[count].offset	= pos;
-			lexeme[count].length	= 0;
-			count++; 
-		};
+// runs a job on a fixed set of threads, the calling thread takes the last index and waits for the rest
+struct WorkerPool {
+	typedef void (*Job)(void *data, int index);
 
-		void lexemeEnd(int pos) {
-			if (count && !lexeme[count - 1].length)
-				lexeme[count - 1].length = pos - lexeme[count - 1].offset;
-		};
+	std::thread				*threads;
+	int						count;
+	std::mutex				mutex;
+	std::condition_variable	wake, done;
+	Job		job;
+	void	*data;
+	int		generation, pending;
+	bool	quit;
 
-		bool checkOpcode(const char *str) {
-			const char *opcodes[] = {	"void", "char", "bool", "short", "int", "long", "float", "double", "this", "typedef", "unsigned", "enum", "union",
-										"sizeof", "return", "const", "static", "struct", "public", "private", "protected", "virtual", "new", "delete",
-										"for", "while", "do", "true", "false", "if", "else", "continue", "break", "switch", "case", "default" };
+	WorkerPool(int count) : threads(NULL), count(count), job(NULL), data(NULL), generation(0), pending(0), quit(false) {
+		if (count > 0)
+			threads = new std::thread[count];
+		for (int i = 0; i < count; i++)
+			threads[i] = std::thread(&WorkerPool::work, this, i);
+	}
 
-			for (int i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++)
-				if (!strcmp(str, opcodes[i]))
-					return true;
-			return false;
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
 		}
+		wake.notify_all();
+		for (int i = 0; i < count; i++)
+			threads[i].join();
+		delete[] threads;
+	}
 
-		bool checkArgument(const char *str) {
-			const char *args[] = { "#include", "#define", "#undef", "#if", "#ifdef", "#ifndef", "#else", "#endif" };
-			for (int i = 0; i < sizeof(args) / sizeof(args[0]); i++)
-				if (!strcmp(str, args[i]))
-					return true;
-			return false;
+	void work(int index) {
+		int seen = 0;
+		while (true) {
+			Job job;
+			void *data;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (!quit && generation == seen)
+					wake.wait(lock);
+				if (quit)
+					return;
+				seen	= generation;
+				job		= this->job;
+				data	= this->data;
+			}
+
+			job(data, index);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!--pending)
+				done.notify_one();
 		}
-		
-		bool checkDefine(const char *str) {
-			const char *defines[] = {	"NULL", "SEEK_END", "SEEK_CUR", "SEEK_SET", "COLOR_CLEAR", "VK_LEFT", "VK_RIGHT", "VK_UP", "VK_DOWN", "VK_BACK", "CALLBACK", "GetWindowLong", "SetWindowLong", "WIN32", "_DEBUG",
-										"GWL_USERDATA", "GWL_WNDPROC", "LOWORD", "HIWORD", "GET_WHEEL_DELTA_WPARAM", "GET_X_LPARAM", "GET_Y_LPARAM", "WM_PAINT", "WM_SIZE", "WM_KEYDOWN", "WM_CHAR", "WM_MOUSEWHEEL", 
-										"WM_LBUTTONDOWN", "WM_LBUTTONUP", "WM_RBUTTONDOWN", "WM_RBUTTONUP", "WM_DESTROY", "DefWindowProc", "CreateWindow", "WS_OVERLAPPEDWINDOW", "SW_SHOWDEFAULT", "GetMessage", "DispatchMessage" };
-			for (int i = 0; i < sizeof(defines) / sizeof(defines[0]); i++)
-				if (!strcmp(str, defines[i]))
-					return true;
-			return false;
+	}
+
+	// calls job(data, i) for every i in [0, count] and returns when all of them are finished
+	void run(Job job, void *data) {
+		if (count) {
+			std::lock_guard<std::mutex> lock(mutex);
+			this->job	= job;
+			this->data	= data;
+			pending		= count;
+			generation++;
+			wake.notify_all();
 		}
 
-		bool checkType(const char *str) {
-			const char *types[] = { "FILE", "BITMAPINFO", "BITMAPINFOHEADER", "MSG", "LONG", "Header", "RGBA", "Point", "Rect", "Color", "Font",  "Canvas", "Editor", "Theme", "Syntax", "Lexeme", "Window", "HWND", "HDC", "LRESULT", "UINT", "WPARAM", "LPARAM" };
-			for (int i = 0; i < sizeof(types) / sizeof(types[0]); i++)
-				if (!strcmp(str, types[i]))
-					return true;
-			return false;
+		job(data, count);
+
+		if (count) {
+			std::unique_lock<std::mutex> lock(mutex);
+			while (pending)
+				done.wait(lock);
 		}
+	}
+};
 
-		void parse(const char *text) {
-			count = 0;
-			if (!text) return;
+struct Canvas {
+	int			width, height;
+	int			stride;		// bytes from one row to the next
+	char		*pixels;
+	PixelFormat	format;
+	int			bytes;		// per pixel
 
-			char	tagText	= '\0';
-			char	tagComm	= '\0';
-			char	last	= '\0';
-			int		length	= strlen(text);
+	// changed areas since the last present, rows with the same span are merged
+	Rect	*damage;
+	int		damageCount, damageCapacity;
+	int		uploaded;	// bytes sent by the last present
 
-			for (int i = 0; i < length; i++) {
-				char c = text[i];
+	// scrolled areas, the window content is moved the same way before the damage is uploaded
+	struct Copy {
+		Rect	rect;
+		int		dx, dy;
+	}		copies[8];
+	int		copyCount;
+	
+#ifdef __linux__
+	// with shared memory two images take turns, the server reads the one put last while the next frame
+	// is drawn into the other, without it a single image is uploaded through the connection
+	struct Buffer {
+		XImage			*image;
+		XShmSegmentInfo	shminfo;
+		bool			busy;	// put and not read by the server yet
+	}		buffers[2];
+	int		current;		// buffer drawn into
+	bool	shm;
+	int		completion;		// event type of XShmCompletionEvent, -1 without shared memory
 
-				if (c == '\\')
-					i++;
-				else
-					if (c == tagText) {
-						lexemeEnd(i + 1);
-						tagText = '\0';
-					} else
-						if (( (c == '\r' || c == '\n') && (tagComm == '\0' || tagComm == '/')) || (tagComm == '*' && c == '/' && last == '*' && i++)) {
-							lexemeEnd(i);
-							tagComm = '\0';
-						} else
-							if (tagText == '\0' && tagComm == '\0')
-								if (c == '/' && (text[i + 1] == '/' || text[i + 1] == '*')) {
-									tagComm = text[i + 1];
-									lexemeBegin(i, Lexeme::ID_COMMENT);
-								} else
-									if (c == '\'' || c == '"') {
-										tagText = c;
-										lexemeBegin(i, Lexeme::ID_TEXT);
-									} else
-										if (c == ' ' || c == '\t')
-											lexemeEnd(i);
-										else
-											if (c >= '0' && c <= '9')
-												lexemeBegin(i, Lexeme::ID_NUMBER);
-											else
-												if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '#')
-													lexemeBegin(i, Lexeme::ID_CODE);
-												else {
-													lexemeEnd(i);
-													lexemeBegin(i, Lexeme::ID_CODE);
-													lexemeEnd(i + 1);
-												}
-				last = c;
-			}
-			lexemeEnd(length);
+	// areas the last present changed in the other buffer, copied over before drawing into this one
+	Rect	*stale;
+	int		staleCount, staleCapacity;
 
-			printf("lexeme count: %d\n", count);
-			for (int i = 0; i < count; i++) {
-				Lexeme &lex = lexeme[i];
-				char *str = new char[lex.length + 1];
-				memcpy(str, &text[lex.offset], lex.length);
-				str[lex.length] = '\0';
+	GC		gc;
+	Display	*display;
 
-				if (checkOpcode(str))
-					lex.id = Lexeme::ID_OPCODE;
-				else
-					if (checkDefine(str))
-						lex.id = Lexeme::ID_DEFINE;
-					else
-						if (checkArgument(str))
-							lex.id = Lexeme::ID_ARGUMENT;
-						else
-							if (checkType(str))
-								lex.id = Lexeme::ID_TYPE;
-				delete[] str;
-			};
+	Canvas(Display *display) : width(0), height(0), pixels(NULL), format(pickFormat(display)), bytes(pixelSize(format)), damage(NULL), damageCount(0), damageCapacity(0), uploaded(0), copyCount(0), current(0), shm(false), completion(-1), stale(NULL), staleCount(0), staleCapacity(0), display(display) {
+		memset(buffers, 0, sizeof(buffers));
+		if (XShmQueryExtension(display)) {
+			shm			= true;
+			completion	= XShmGetEventBase(display) + ShmCompletion;
+		} else
+			printf("SHM is not supported, using XPutImage\n");
+		gc = DefaultGC(display, DefaultScreen(display));
+	}
 
-		};
+	// headless, the pixels are plain memory and present only clears the damage
+	Canvas(PixelFormat format = FORMAT_32) : width(0), height(0), pixels(NULL), format(format), bytes(pixelSize(format)), damage(NULL), damageCount(0), damageCapacity(0), uploaded(0), copyCount(0), current(0), shm(false), completion(-1), stale(NULL), staleCount(0), staleCapacity(0), display(NULL) {
+		memset(buffers, 0, sizeof(buffers));
+	}
+#endif
 
-	} syntax;
+#ifdef WIN32
+	Canvas() : width(0), height(0), pixels(NULL), format(FORMAT_32), bytes(4), damage(NULL), damageCount(0), damageCapacity(0), uploaded(0), copyCount(0) {}
+#endif
 
-	struct Cell {
-		union {
-			struct {
-				int	id;
-			};
-			struct {
-				char	c;
-				char	fColor;
-				char	bColor;
-				char	reserved;
-			};
-		};
-	} *cells;
-	int	cols, rows;
+	~Canvas() {
+		resize(0, 0);
+		if (damage) free(damage);
+	#ifdef __linux__
+		if (stale) free(stale);
+	#endif
+	}
 
-	ThemeColor	fColor, bColor;
-	int			curBuffer;
+	static void append(Rect *&list, int &count, int &capacity, const Rect &rect) {
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			list = (Rect*)realloc(list, capacity * sizeof(Rect));
+		}
+		list[count++] = rect;
+	}
 
-	Editor(const Theme &theme) : text(NULL), cursor(0, 0), scroll(0, 0), offset(0, 0), valid(false), theme(theme), cells(NULL), cols(0), rows(0), curBuffer(0) {
-		font = new BitFont("font.dat");
+	void invalidate(Rect rect) {
+		if (rect.l < 0)			rect.l = 0;
+		if (rect.t < 0)			rect.t = 0;
+		if (rect.r > width)		rect.r = width;
+		if (rect.b > height)	rect.b = height;
+		if (rect.l >= rect.r || rect.t >= rect.b)
+			return;
 
-		FILE *f = fopen("main.cpp", "rb");
+		if (damageCount) {
+			Rect &last = damage[damageCount - 1];
+			if (last.l == rect.l && last.r == rect.r && last.b == rect.t) {
+				last.b = rect.b;
+				return;
+			}
+		}
 
-		fseek(f, 0, SEEK_END);
-		int size = ftell(f);
-		fseek(f, 0, SEEK_SET);
-		text = (char*)malloc(size + 1);
-		fread(text, 1, size, f);
-		text[size] = '\0';
-		fclose(f);
-		syntax.parse(text);
+		append(damage, damageCount, damageCapacity, rect);
 	}
 
-	~Editor() { 
-		delete font;
-		if (text) free(text);
-		if (cells) free(cells);
+	void invalidate() {
+		damageCount = 0;
+		copyCount = 0;
+		invalidate(Rect(0, 0, width, height));
 	}
 
-	void invalidate(const Rect &rect) {
-		valid = false;
+	// source and destination of a scrolled area
+	static void copyRects(const Copy &copy, Rect &src, Rect &dst) {
+		src = copy.rect;
+		if (copy.dx > 0) src.r -= copy.dx; else src.l -= copy.dx;
+		if (copy.dy > 0) src.b -= copy.dy; else src.t -= copy.dy;
+		dst = Rect(src.l + copy.dx, src.t + copy.dy, src.r + copy.dx, src.b + copy.dy);
 	}
 
-	void onKey(int key) {
-		if (key == VK_LEFT)		cursor.x--;
-		if (key == VK_RIGHT)	cursor.x++;
-		if (key == VK_UP)		cursor.y--;
-		if (key == VK_DOWN)		cursor.y++;
-		if (key == VK_BACK)		if (text && strlen(text)) { text[strlen(text) - 1] = '\0'; syntax.parse(text); }
+	// moves the pixels of the area, the uncovered strip is left for the caller to redraw
+	void scroll(const Rect &rect, int dx, int dy) {
+		if (!dx && !dy)
+			return;
 
-		valid = false;
-	};
+		Copy copy = { rect, dx, dy };
+		Rect src, dst;
+		copyRects(copy, src, dst);
 
-	void onChar(unsigned char c) {
-		if (c < ' ' && c != '\r' && c != '\t')
+		if (src.l >= src.r || src.t >= src.b || copyCount == sizeof(copies) / sizeof(copies[0])) {
+			invalidate(rect);
 			return;
+		}
 
-		int len = text ? strlen(text) : 0;
-		text = (char*)realloc(text, len + 2);
-		text[len]		= c;
-		text[len + 1]	= 0;
+		int size = (src.r - src.l) * bytes;
+		if (dy > 0)
+			for (int y = src.b - 1; y >= src.t; y--)
+				memmove(at(dst.l, y + dy), at(src.l, y), size);
+		else
+			for (int y = src.t; y < src.b; y++)
+				memmove(at(dst.l, y + dy), at(src.l, y), size);
 
-		syntax.parse(text);
+	// areas waiting for upload moved along with their pixels
+		int count = damageCount;
+		for (int i = 0; i < count; i++) {
+			Rect r = damage[i];
+			if (r.r > rect.l && r.l < rect.r && r.b > rect.t && r.t < rect.b)
+				invalidate(Rect(r.l + dx, r.t + dy, r.r + dx, r.b + dy));
+		}
+
+		copies[copyCount++] = copy;
+	}
+
+	void scrollX(const Rect &rect, int delta) {
+		scroll(rect, delta, 0);
+	}
+
+	void scrollY(const Rect &rect, int offset) {
+		scroll(rect, 0, offset);
+	}
+
+	void resize(int width, int height) {
+		if (this->width != width || this->height != height) {
+			this->width = width;
+			this->height = height;
+			invalidate();
+		
+		#ifdef __linux__
+			if (display) {
+				resizeImage();
+				return;
+			}
+		#endif
+
+			pixels = (char*)realloc(pixels, width * height * bytes);
+			stride = width * bytes;
+		}
+	}
+
+#ifdef __linux__
+	// the layout images of the screen depth have, read once as the glyph and fill code is compiled for each
+	static PixelFormat pickFormat(Display *display) {
+		int depth = DefaultDepth(display, DefaultScreen(display));
+		int bits = 32, count;
+		XPixmapFormatValues *formats = XListPixmapFormats(display, &count);
+		for (int i = 0; i < count; i++)
+			if (formats[i].depth == depth)
+				bits = formats[i].bits_per_pixel;
+		if (formats)
+			XFree(formats);
+
+		switch (bits) {
+		case 32:	return FORMAT_32;
+		case 24:	return FORMAT_24;
+		case 16:	return depth == 15 ? FORMAT_15 : FORMAT_16;
+		}
+		printf("%d bit pixels aren't supported, drawing 32 bit ones\n", bits);
+		return FORMAT_32;
+	}
+
+	static bool& attachFailed() {
+		static bool failed = false;
+		return failed;
+	}
+
+	static int onAttachError(Display*, XErrorEvent*) {
+		attachFailed() = true;
+		return 0;
+	}
+
+	// false when the server can't attach the segment, which happens on remote displays
+	bool createShared(Buffer &buffer, int depth) {
+		Visual *visual = DefaultVisual(display, DefaultScreen(display));
+		buffer.image = XShmCreateImage(display, visual, depth, ZPixmap, NULL, &buffer.shminfo, width, height);
+		if (!buffer.image)
+			return false;
+
+		buffer.shminfo.shmid = shmget(IPC_PRIVATE, buffer.image->bytes_per_line * buffer.image->height, IPC_CREAT|0600);
+		if (buffer.shminfo.shmid == -1) {
+			XDestroyImage(buffer.image);
+			memset(&buffer, 0, sizeof(buffer));
+			return false;
+		}
+		buffer.shminfo.shmaddr	= buffer.image->data = (char*)shmat(buffer.shminfo.shmid, 0, 0);
+		buffer.shminfo.readOnly	= false;
+
+		attachFailed() = false;
+		XErrorHandler handler = XSetErrorHandler(onAttachError);
+		XShmAttach(display, &buffer.shminfo);
+		XSync(display, false);
+		XSetErrorHandler(handler);
+	// the segment goes away once both sides have detached
+		shmctl(buffer.shminfo.shmid, IPC_RMID, 0);
+
+		if (attachFailed()) {
+			XDestroyImage(buffer.image);
+			shmdt(buffer.shminfo.shmaddr);
+			memset(&buffer, 0, sizeof(buffer));
+			return false;
+		}
+		return true;
+	}
+
+	void createPlain(Buffer &buffer, int depth) {
+		Visual *visual = DefaultVisual(display, DefaultScreen(display));
+		buffer.image		= XCreateImage(display, visual, depth, ZPixmap, 0, NULL, width, height, 32, 0);
+		buffer.image->data	= (char*)malloc(buffer.image->bytes_per_line * height);
+	}
+
+	void destroyImage(Buffer &buffer) {
+		if (!buffer.image)
+			return;
+		if (buffer.shminfo.shmaddr) {
+			wait(buffer);
+			XShmDetach(display, &buffer.shminfo);
+			XDestroyImage(buffer.image);
+			shmdt(buffer.shminfo.shmaddr);
+		} else
+			XDestroyImage(buffer.image);
+		memset(&buffer, 0, sizeof(buffer));
+	}
+
+	void resizeImage() {
+		destroyImage(buffers[0]);
+		destroyImage(buffers[1]);
+		current	= 0;
+		pixels	= NULL;
+
+		if (!width || !height)
+			return;
+
+		int depth = DefaultDepth(display, DefaultScreen(display));
+
+		if (shm && !(createShared(buffers[0], depth) && createShared(buffers[1], depth))) {
+			printf("SHM can't be attached, using XPutImage\n");
+			destroyImage(buffers[0]);
+			shm			= false;
+			completion	= -1;
+		}
+		if (!shm)
+			createPlain(buffers[0], depth);
+
+		pixels = buffers[0].image->data;
+		stride = buffers[0].image->bytes_per_line;
+	}
+
+	// shared images or XPutImage, the images are made again and drawn from scratch
+	void setShared(bool shared) {
+		if (!display)
+			return;
+		destroyImage(buffers[0]);
+		destroyImage(buffers[1]);
+		shm			= shared && XShmQueryExtension(display);
+		completion	= shm ? XShmGetEventBase(display) + ShmCompletion : -1;
+		resizeImage();
+		invalidate();
+	}
+
+	static Bool isCompletion(Display*, XEvent *e, XPointer canvas) {
+		return e->type == ((Canvas*)canvas)->completion;
+	}
+
+	// the server is done reading an image, the event loop hands these over too
+	void complete(const XEvent &e) {
+		const XShmCompletionEvent &done = (const XShmCompletionEvent&)e;
+		for (int i = 0; i < 2; i++)
+			if (buffers[i].image && buffers[i].shminfo.shmseg == done.shmseg)
+				buffers[i].busy = false;
+	}
+
+	// blocks until the server has read the buffer, other events stay queued
+	void wait(Buffer &buffer) {
+		while (buffer.busy) {
+			XEvent e;
+			XIfEvent(display, &e, isCompletion, (XPointer)this);
+			complete(e);
+		}
+	}
+#endif
+
+	// nothing to show, the damage is only counted, used by the headless canvas
+	void present() {
+		uploaded = 0;
+		for (int i = 0; i < damageCount; i++)
+			uploaded += (damage[i].r - damage[i].l) * (damage[i].b - damage[i].t) * bytes;
+		damageCount = 0;
+		copyCount = 0;
+	}
+	
+#ifdef WIN32
+	void present(HDC dc) {
+		uploaded = 0;
+
+		for (int i = 0; i < copyCount; i++) {
+			Rect src, dst;
+			copyRects(copies[i], src, dst);
+			BitBlt(dc, dst.l, dst.t, dst.r - dst.l, dst.b - dst.t, dc, src.l, src.t, SRCCOPY);
+		}
+		copyCount = 0;
+
+		if (!damageCount)
+			return;
+	//	RECT r = { 0, 0, width, height };
+	//	FillRect(dc, &r, (HBRUSH)GetStockObject(BLACK_BRUSH));
+		BITMAPINFO bmi = {sizeof(BITMAPINFOHEADER), width, -height, 1, 32, BI_RGB, 0, 0, 0, 0, 0};
+		for (int i = 0; i < damageCount; i++) {
+			Rect &rect = damage[i];
+			SetDIBitsToDevice(dc, rect.l, rect.t, rect.r - rect.l, rect.b - rect.t, rect.l, rect.t, rect.t, rect.b, pixels, &bmi, 0);
+			uploaded += (rect.r - rect.l) * (rect.b - rect.t) * bytes;
+		}
+		damageCount = 0;
+	//	SetDIBitsToDevice(dc, 0, 0, width, height, 0, 0, 0, height, pixels, &bmi, 0);
+	}
+#endif
+
+#ifdef __linux__
+	void present(const Window &window) {
+		uploaded = 0;
+		if (!pixels || (!copyCount && !damageCount))
+			return;
+
+	// server side copies, obscured parts come back as GraphicsExpose
+		staleCount = 0;
+		for (int i = 0; i < copyCount; i++) {
+			Rect src, dst;
+			copyRects(copies[i], src, dst);
+			XCopyArea(display, window, window, gc, src.l, src.t, src.r - src.l, src.b - src.t, dst.l, dst.t);
+			append(stale, staleCount, staleCapacity, dst);
+		}
+		copyCount = 0;
+
+	// the server reports when it has read the last put, the ones before it are done by then, without
+	// shared memory only the damaged rows go through the connection
+		Buffer &front = buffers[current];
+		for (int i = 0; i < damageCount; i++) {
+			Rect &rect = damage[i];
+			if (shm)
+				XShmPutImage(display, window, gc, front.image, rect.l, rect.t, rect.l, rect.t, rect.r - rect.l, rect.b - rect.t, i == damageCount - 1);
+			else
+				XPutImage(display, window, gc, front.image, rect.l, rect.t, rect.l, rect.t, rect.r - rect.l, rect.b - rect.t);
+			uploaded += (rect.r - rect.l) * (rect.b - rect.t) * bytes;
+			append(stale, staleCount, staleCapacity, rect);
+		}
+		front.busy = shm && damageCount;
+		damageCount = 0;
+		XFlush(display);
+
+	// the next frame goes into the other image while the server reads this one, it gets what changed here first
+		if (shm) {
+			current ^= 1;
+			Buffer &back = buffers[current];
+			wait(back);
+
+			char *src = pixels;
+			pixels = back.image->data;
+			for (int i = 0; i < staleCount; i++) {
+				Rect &rect = stale[i];
+				for (int y = rect.t; y < rect.b; y++)
+					memcpy(at(rect.l, y), &src[rect.l * bytes + y * stride], (rect.r - rect.l) * bytes);
+			}
+		}
+	}
+#endif
+	char* at(int x, int y) {
+		return &pixels[x * bytes + y * stride];
+	}
+
+	template <class F>
+	void fill(int x, int y, int w, int h, Color color) {
+		typename F::Pixel p = F::pack(color);
+		for (int j = y; j < y + h; j++) {
+			typename F::Pixel *row = (typename F::Pixel*)at(x, j);
+			for (int i = 0; i < w; i++)
+				row[i] = p;
+		}
+	}
+
+	void fill(int x, int y, int w, int h, Color color) {
+		switch (format) {
+		case FORMAT_32:	fill<Format32>(x, y, w, h, color);	break;
+		case FORMAT_24:	fill<Format24>(x, y, w, h, color);	break;
+		case FORMAT_16:	fill<Format16>(x, y, w, h, color);	break;
+		case FORMAT_15:	fill<Format15>(x, y, w, h, color);	break;
+		default:		break;
+		}
+	}
+};
+
+#ifdef XEDIT_PROFILE
+#define PROFILE_FRAMES	4096	// frames kept for the export, the oldest are dropped
+#define PROFILE_EVENTS	65536	// timed stages kept for the trace
+#define PROFILE_THREADS	64		// threads told apart in the trace
+#define CHAR_PROFILE	16		// ctrl+p, shows and hides the stage times
+
+// where the time of a frame goes, stages are timed on any thread and add up in the frame that is open,
+// the ones between two frames, like the relex of an edit, go to the next frame which is the one showing them
+struct Profiler {
+	enum Stage {
+		STAGE_PARSE,
+		STAGE_LAYOUT,
+		STAGE_RASTER,
+		STAGE_PRESENT,
+		STAGE_MAX
+	};
+
+	enum Counter {
+		COUNTER_CELLS,	// cells that differ from the last frame
+		COUNTER_GLYPHS,	// changed cells with a character
+		COUNTER_BYTES,	// pixel bytes sent to the window
+		COUNTER_MAX
+	};
+
+	struct Frame {
+		double	start, length;	// seconds since the profiler started, length is 0 while the frame is open
+		double	time[STAGE_MAX];
+		int		count[COUNTER_MAX];
+	};
+
+	struct Event {
+		int		stage, thread;
+		double	start, length;
+	};
+
+	std::mutex		mutex;
+	double			origin;
+	Frame			*frames;	// rings, frameCount and eventCount are the totals so far
+	Event			*events;
+	int				frameCount, eventCount;
+	std::thread::id	threads[PROFILE_THREADS];
+	int				threadCount;
+	double			pending[STAGE_MAX];	// stage times since the last frame closed
+	bool			hud;		// the editor draws the last frame over the top right corner, toggled with ctrl+p
+
+	Profiler() : origin(getTime()), frameCount(0), eventCount(0), threadCount(0), hud(false) {
+		frames = new Frame[PROFILE_FRAMES];
+		events = new Event[PROFILE_EVENTS];
+		memset(pending, 0, sizeof(pending));
+	}
+
+	~Profiler() {
+		delete[] frames;
+		delete[] events;
+	}
+
+	static const char* name(int stage) {
+		static const char *names[STAGE_MAX] = { "parse", "layout", "raster", "present" };
+		return names[stage];
+	}
+
+	// small numbers for the trace, the first thread seen is 0
+	int thread() {
+		std::thread::id id = std::this_thread::get_id();
+		for (int i = 0; i < threadCount; i++)
+			if (threads[i] == id)
+				return i;
+		if (threadCount == PROFILE_THREADS)
+			return PROFILE_THREADS;
+		threads[threadCount] = id;
+		return threadCount++;
+	}
+
+	void beginFrame() {
+		std::lock_guard<std::mutex> lock(mutex);
+		Frame &frame = frames[frameCount++ % PROFILE_FRAMES];
+		memset(&frame, 0, sizeof(frame));
+		frame.start = getTime() - origin;
+		memcpy(frame.time, pending, sizeof(pending));
+		memset(pending, 0, sizeof(pending));
+	}
+
+	void endFrame() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (frameCount) {
+			Frame &frame = frames[(frameCount - 1) % PROFILE_FRAMES];
+			frame.length = getTime() - origin - frame.start;
+		}
+	}
+
+	void add(int stage, double start, double end) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (frameCount && frames[(frameCount - 1) % PROFILE_FRAMES].length == 0.0)
+			frames[(frameCount - 1) % PROFILE_FRAMES].time[stage] += end - start;
+		else
+			pending[stage] += end - start;
+
+		Event &event = events[eventCount++ % PROFILE_EVENTS];
+		event.stage		= stage;
+		event.thread	= thread();
+		event.start		= start - origin;
+		event.length	= end - start;
+	}
+
+	void count(int counter, int n) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (frameCount)
+			frames[(frameCount - 1) % PROFILE_FRAMES].count[counter] += n;
+	}
+
+	// the newest frame that is closed, false before the first one
+	bool last(Frame &frame) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int i = frameCount - 1; i >= 0 && i >= frameCount - 2; i--)
+			if (frames[i % PROFILE_FRAMES].length > 0.0) {
+				frame = frames[i % PROFILE_FRAMES];
+				return true;
+			}
+		return false;
+	}
+
+	// a .json name gets the trace event format chrome://tracing and Perfetto load, anything else
+	// gets a CSV line of stage milliseconds and counters per frame
+	bool write(const char *name) {
+		FILE *f = fopen(name, "w");
+		if (!f)
+			return false;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		const char *ext = strrchr(name, '.');
+		if (ext && !strcmp(ext, ".json"))
+			writeTrace(f);
+		else
+			writeCSV(f);
+		fclose(f);
+		return true;
+	}
+
+	void writeTrace(FILE *f) {
+		fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"window\"}}");
+
+		for (int i = frameCount > PROFILE_FRAMES ? frameCount - PROFILE_FRAMES : 0; i < frameCount; i++) {
+			Frame &frame = frames[i % PROFILE_FRAMES];
+			fprintf(f, ",\n{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.1f,\"dur\":%.1f}",
+				frame.start * 1000000.0, frame.length * 1000000.0);
+			fprintf(f, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":%.1f,\"args\":{\"cells\":%d,\"glyphs\":%d,\"bytes\":%d}}",
+				frame.start * 1000000.0, frame.count[COUNTER_CELLS], frame.count[COUNTER_GLYPHS], frame.count[COUNTER_BYTES]);
+		}
+
+		for (int i = eventCount > PROFILE_EVENTS ? eventCount - PROFILE_EVENTS : 0; i < eventCount; i++) {
+			Event &event = events[i % PROFILE_EVENTS];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}",
+				name(event.stage), event.thread, event.start * 1000000.0, event.length * 1000000.0);
+		}
+		fprintf(f, "\n]}\n");
+	}
+
+	void writeCSV(FILE *f) {
+		fprintf(f, "frame,start,total");
+		for (int s = 0; s < STAGE_MAX; s++)
+			fprintf(f, ",%s", name(s));
+		fprintf(f, ",cells,glyphs,bytes\n");
+
+		for (int i = frameCount > PROFILE_FRAMES ? frameCount - PROFILE_FRAMES : 0; i < frameCount; i++) {
+			Frame &frame = frames[i % PROFILE_FRAMES];
+			fprintf(f, "%d,%.3f,%.3f", i, frame.start * 1000.0, frame.length * 1000.0);
+			for (int s = 0; s < STAGE_MAX; s++)
+				fprintf(f, ",%.3f", frame.time[s] * 1000.0);
+			fprintf(f, ",%d,%d,%d\n", frame.count[COUNTER_CELLS], frame.count[COUNTER_GLYPHS], frame.count[COUNTER_BYTES]);
+		}
+	}
+};
+
+static Profiler profiler;
+
+// times the rest of the block
+struct ProfileScope {
+	int		stage;
+	double	start;
+
+	ProfileScope(int stage) : stage(stage), start(getTime()) {}
+
+	~ProfileScope() {
+		profiler.add(stage, start, getTime());
+	}
+};
+
+	#define PROFILE_SCOPE(stage)		ProfileScope profileScope(Profiler::stage)
+	#define PROFILE_COUNT(counter, n)	profiler.count(Profiler::counter, n)
+	#define PROFILE_BEGIN_FRAME()		profiler.beginFrame()
+	#define PROFILE_END_FRAME()			profiler.endFrame()
+#else
+	#define PROFILE_SCOPE(stage)
+	#define PROFILE_COUNT(counter, n)
+	#define PROFILE_BEGIN_FRAME()
+	#define PROFILE_END_FRAME()
+#endif
+
+#ifdef XEDIT_LATENCY
+#define LATENCY_EVENTS	65536	// input events timed in a run, the ones after are dropped
+
+// input to screen times of the key presses and wheel clicks the loop takes, from their arrival through
+// the editor to the frame showing them being done on the server, the driver sending them fills in when
+// and in which run it sent each one, the server keeps the order so they are matched up in turn
+struct Latency {
+	struct Event {
+		int		kind;		// run of the driver, -1 if it didn't send the event
+		double	sent;		// by the driver, 0 if it didn't send it
+		double	arrived;	// taken off the connection by the loop
+		double	handled;	// the editor is done with it
+		double	shown;		// the frame with it is done on the server, 0 until then
+	};
+
+	struct Sent {
+		int		kind;
+		double	time;
+	};
+
+	Event		events[LATENCY_EVENTS];
+	Sent		sent[LATENCY_EVENTS];
+	int			count, shown;		// the events before shown are on the screen
+	int			sentCount, taken;	// sent ones before taken have arrived
+	std::mutex	lock;
+
+	Latency() {
+		clear();
+	}
+
+	void clear() {
+		count = shown = sentCount = taken = 0;
+	}
+
+	static bool isInput(const XEvent &e) {
+		return e.type == KeyPress || e.type == ButtonPress;
+	}
+
+	// on the driver thread, right before the event goes out
+	void send(int kind) {
+		std::lock_guard<std::mutex> l(lock);
+		if (sentCount < LATENCY_EVENTS) {
+			Sent s = { kind, getTime() };
+			sent[sentCount++] = s;
+		}
+	}
+
+	void arrive(const XEvent &e) {
+		if (!isInput(e) || count == LATENCY_EVENTS)
+			return;
+		Event &event = events[count++];
+		event.arrived	= getTime();
+		event.handled	= event.shown = 0.0;
+		event.kind		= -1;
+		event.sent		= 0.0;
+
+		std::lock_guard<std::mutex> l(lock);
+		if (taken < sentCount) {
+			event.kind	= sent[taken].kind;
+			event.sent	= sent[taken++].time;
+		}
+	}
+
+	void handle(const XEvent &e) {
+		if (isInput(e) && count)
+			events[count - 1].handled = getTime();
+	}
+
+	// after the frame went out, the round trip waits for the server to draw it
+	void present(Display *display) {
+		if (shown == count)
+			return;
+		XSync(display, false);
+		double time = getTime();
+		for (; shown < count; shown++)
+			events[shown].shown = time;
+	}
+};
+
+static Latency latency;
+
+	#define LATENCY_ARRIVE(e)			latency.arrive(e)
+	#define LATENCY_HANDLE(e)			latency.handle(e)
+	#define LATENCY_PRESENT(display)	latency.present(display)
+#else
+	#define LATENCY_ARRIVE(e)
+	#define LATENCY_HANDLE(e)
+	#define LATENCY_PRESENT(display)
+#endif
+
+// array with a movable gap, inserting and removing items at the gap doesn't touch the rest
+template <typename T>
+struct GapArray {
+	T	*items;
+	int	count, capacity;
+	int	gap;
+
+	GapArray() : items(NULL), count(0), capacity(0), gap(0) {}
+
+	~GapArray() {
+		if (items) free(items);
+	}
+
+	T& operator [] (int index) {
+		return items[index < gap ? index : index + capacity - count];
+	}
+
+	const T& operator [] (int index) const {
+		return items[index < gap ? index : index + capacity - count];
+	}
+
+	// number of items after the gap
+	int tail() const {
+		return count - gap;
+	}
+
+	void clear() {
+		count = gap = 0;
+	}
+
+	void moveGap(int index) {
+		if (index == gap)
+			return;
+		int size = capacity - count;
+		if (index < gap)
+			memmove(&items[index + size], &items[index], (gap - index) * sizeof(T));
+		else
+			memmove(&items[gap], &items[gap + size], (index - gap) * sizeof(T));
+		gap = index;
+	}
+
+	void reserve(int num) {
+		if (count + num <= capacity)
+			return;
+		int after = count - gap;
+		int size = capacity ? capacity * 2 : 1024;
+		while (size < count + num)
+			size *= 2;
+		items = (T*)realloc(items, size * sizeof(T));
+		memmove(&items[size - after], &items[capacity - after], after * sizeof(T));
+		capacity = size;
+	}
+
+	void insert(const T &item) {
+		if (count == capacity)
+			reserve(1);
+		items[gap++] = item;
+		count++;
+	}
+
+	void insert(const T *src, int num) {
+		if (!num)
+			return;
+		reserve(num);
+		memcpy(&items[gap], src, num * sizeof(T));
+		gap		+= num;
+		count	+= num;
+	}
+
+	// removes items right after the gap
+	void erase(int num) {
+		count -= num;
+	}
+};
+
+// text offsets, the ones after the gap share a pending shift so edits don't rewrite them all
+struct OffsetArray : GapArray<int> {
+	int delta;
+
+	OffsetArray() : delta(0) {}
+
+	int operator [] (int index) const {
+		return index < gap ? items[index] : items[index + capacity - count] + delta;
+	}
+
+	void clear() {
+		GapArray<int>::clear();
+		delta = 0;
+	}
+
+	void moveGap(int index) {
+		int from = gap;
+		GapArray<int>::moveGap(index);
+		if (index > from)
+			for (int i = from; i < index; i++)
+				items[i] += delta;
+		else
+			for (int i = index + capacity - count; i < from + capacity - count; i++)
+				items[i] -= delta;
+	}
+
+	void shift(int delta) {
+		this->delta += delta;
+	}
+};
+
+struct TextBuffer {
+	struct Piece {
+		bool	added;
+		int		start;
+		int		length;
+	};
+
+	struct Iterator {
+		const TextBuffer	*buffer;
+		int					piece;
+		const char			*ptr, *end;
+
+		char operator * () const {
+			return *ptr;
+		}
+
+		void operator ++ () {
+			if (ptr != end && ++ptr == end)
+				next();
+		}
+
+		void next() {
+			if (++piece < buffer->pieces.count) {
+				ptr = buffer->pieceData(piece);
+				end = ptr + buffer->pieces[piece].length;
+			} else
+				ptr = end = NULL;
+		}
+
+		char peek() const {
+			if (ptr + 1 < end)
+				return ptr[1];
+			if (ptr && piece + 1 < buffer->pieces.count)
+				return *buffer->pieceData(piece + 1);
+			return '\0';
+		}
+	};
+
+	char			*original;
+	int				mapped;		// size of the read only file mapping original points into, 0 for a malloc'ed copy
+	char			*added;
+	int				addedLength, addedCapacity;
+	GapArray<Piece>	pieces;		// gap at the last edit, so typing doesn't move the pieces after it
+	OffsetArray		starts;		// text offset of every piece, kept in step with pieces
+	int				length;
+
+	// piece the last lookup ended in, threads reading the text at once each bring their own copy
+	struct Cache {
+		int index, start;
+	};
+	mutable Cache cache;
+
+	TextBuffer() : original(NULL), mapped(0), added(NULL), addedLength(0), addedCapacity(0), length(0) {
+		cache.index = 0;
+		cache.start = 0;
+	}
+
+	~TextBuffer() {
+		release();
+		if (added)
+			free(added);
+	}
+
+	void release() {
+		if (!original)
+			return;
+		if (!mapped)
+			free(original);
+	#ifdef WIN32
+		else
+			UnmapViewOfFile(original);
+	#endif
+	#ifdef __linux__
+		else
+			munmap(original, mapped);
+	#endif
+		original = NULL;
+	}
+
+	// the text starts out as the file mapping, pages are only read once something looks at them
+	bool map(const char *name) {
+		int size;
+		char *data = NULL;
+	#ifdef WIN32
+		HANDLE file = CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		if (fileSize.QuadPart > 0x7FFFFFFF) {
+			CloseHandle(file);
+			return false;
+		}
+		size = (int)fileSize.QuadPart;
+		if (size) {
+			HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping) {
+				data = (char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+	#endif
+
+	#ifdef __linux__
+		int fd = ::open(name, O_RDONLY);
+		if (fd == -1)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) || st.st_size > 0x7FFFFFFF) {
+			::close(fd);
+			return false;
+		}
+		size = (int)st.st_size;
+		if (size) {
+			data = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED)
+				data = NULL;
+		}
+		::close(fd);
+	#endif
+
+		if (size && !data)
+			return false;
+		load(data, size);
+		mapped = data ? size : 0;
+		return true;
+	}
+
+	// takes ownership of the malloc'ed data
+	void load(char *data, int size) {
+		release();
+		original	= data;
+		mapped		= 0;
+		addedLength	= 0;
+		length		= size;
+		pieces.clear();
+		starts.clear();
+		cache.index	= 0;
+		cache.start	= 0;
+		if (size)
+			insertPiece(0, false, 0, 0, size);
+	}
+
+	const char* pieceData(int index) const {
+		const Piece &p = pieces[index];
+		return (p.added ? added : original) + p.start;
+	}
+
+	// reads go on from where the last one ended most of the time, so the last located piece and the one
+	// after it are tried first, anything else is a binary search over the piece starts
+	int locate(int pos, int &start, Cache &cache) const {
+		int count = pieces.count;
+		int i = cache.index;
+		int s = cache.start;
+
+		if (pos >= length) {
+			i = count;
+			s = length;
+		} else if (i < count && pos >= s && pos < s + pieces[i].length) {
+		} else if (i + 1 < count && pos >= s + pieces[i].length && pos < starts[i + 1] + pieces[i + 1].length) {
+			s = starts[++i];
+		} else {
+			int low = 0, high = count - 1;
+			while (low < high) {
+				int mid = (low + high + 1) >> 1;
+				if (starts[mid] <= pos)
+					low = mid;
+				else
+					high = mid - 1;
+			}
+			i = low;
+			s = starts[i];
+		}
+
+		cache.index = i;
+		cache.start = s;
+		start = s;
+		return i;
+	}
+
+	int locate(int pos, int &start) const {
+		return locate(pos, start, cache);
+	}
+
+	Iterator at(int pos, Cache &cache) const {
+		Iterator it;
+		it.buffer = this;
+		int start;
+		it.piece = locate(pos, start, cache);
+		if (it.piece < pieces.count) {
+			it.ptr = pieceData(it.piece) + pos - start;
+			it.end = pieceData(it.piece) + pieces[it.piece].length;
+		} else
+			it.ptr = it.end = NULL;
+		return it;
+	}
+
+	Iterator at(int pos) const {
+		return at(pos, cache);
+	}
+
+	Iterator begin() const {
+		return at(0);
+	}
+
+	char operator [] (int pos) const {
+		int start;
+		int i = locate(pos, start);
+		return i < pieces.count ? pieceData(i)[pos - start] : '\0';
+	}
+
+	// direct pointer when the range lies in a single piece, a copy in buf otherwise
+	const char* data(int pos, int len, char *buf, Cache &cache) const {
+		int start;
+		int i = locate(pos, start, cache);
+		if (i < pieces.count && pos + len <= start + pieces[i].length)
+			return pieceData(i) + pos - start;
+		copy(pos, len, buf, cache);
+		return buf;
+	}
+
+	const char* data(int pos, int len, char *buf) const {
+		return data(pos, len, buf, cache);
+	}
+
+	// offset of the first c at or after pos, the length if there's none
+	int find(char c, int pos, Cache &cache) const {
+		int start;
+		for (int i = locate(pos, start, cache); i < pieces.count; i++) {
+			const char *data = pieceData(i);
+			const char *p = (const char*)memchr(data + pos - start, c, start + pieces[i].length - pos);
+			if (p)
+				return start + (int)(p - data);
+			start	+= pieces[i].length;
+			pos		= start;
+		}
+		return length;
+	}
+
+	int copy(int pos, int len, char *dst, Cache &cache) const {
+		if (len > length - pos)
+			len = length - pos;
+		int start;
+		int i = locate(pos, start, cache);
+		int done = 0;
+		while (done < len) {
+			int n = pieces[i].length - (pos - start);
+			if (n > len - done)
+				n = len - done;
+			memcpy(dst + done, pieceData(i) + pos - start, n);
+			done	+= n;
+			pos		+= n;
+			start	+= pieces[i++].length;
+		}
+		return len;
+	}
+
+	int copy(int pos, int len, char *dst) const {
+		return copy(pos, len, dst, cache);
+	}
+
+	// both gaps move to the edited piece, the starts after it take the change in length as a pending shift
+	void moveGap(int index) {
+		pieces.moveGap(index);
+		starts.moveGap(index);
+	}
+
+	void insertPiece(int index, bool added, int start, int offset, int length) {
+		Piece p;
+		p.added		= added;
+		p.start		= start;
+		p.length	= length;
+		moveGap(index);
+		pieces.insert(p);
+		starts.insert(offset);
+	}
+
+	void removePieces(int index, int num) {
+		moveGap(index);
+		pieces.erase(num);
+		starts.erase(num);
+	}
+
+	void split(int index, int at) {
+		Piece p = pieces[index];
+		insertPiece(index + 1, p.added, p.start + at, starts[index] + at, p.length - at);
+		pieces[index].length = at;
+	}
+
+	void insert(int pos, const char *str, int len) {
+		if (len <= 0 || pos < 0 || pos > length)
+			return;
+
+		if (addedLength + len > addedCapacity) {
+			addedCapacity = addedCapacity ? addedCapacity * 2 : 4096;
+			if (addedCapacity < addedLength + len)
+				addedCapacity = addedLength + len;
+			added = (char*)realloc(added, addedCapacity);
+		}
+		memcpy(added + addedLength, str, len);
+
+		int start;
+		int i = locate(pos, start);
+		Piece *prev = i > 0 ? &pieces[i - 1] : NULL;
+
+		if (pos == start && prev && prev->added && prev->start + prev->length == addedLength) {
+		// typing continues the previous insertion, grow its piece in place
+			cache.index = i - 1;
+			cache.start = start - prev->length;
+			prev->length += len;
+			moveGap(i);
+		} else {
+			if (pos > start)
+				split(i++, pos - start);
+			insertPiece(i, true, addedLength, pos, len);
+			cache.index = i;
+			cache.start = pos;
+		}
+		starts.shift(len);
+
+		addedLength	+= len;
+		length		+= len;
+	}
+
+	void remove(int pos, int len) {
+		if (len > length - pos)
+			len = length - pos;
+		if (len <= 0 || pos < 0)
+			return;
+
+		int start;
+		int i = locate(pos, start);
+		int removed = len;
+		length -= len;
+
+		if (pos > start) {
+			Piece &p = pieces[i];
+			int head = pos - start;
+			int tail = p.length - head - len;
+
+			if (tail > 0) {
+			// removal inside of a single piece
+				split(i, head);
+				pieces[i + 1].start		+= len;
+				pieces[i + 1].length	-= len;
+				starts.shift(-len);
+				return;
+			}
+
+			if (p.added && p.start + p.length == addedLength)
+				addedLength -= p.length - head;	// nothing else references the tail of the last insertion
+			len -= p.length - head;
+			p.length = head;
+			start = pos;
+			i++;
+		}
+
+		int num = 0;
+		while (i + num < pieces.count && pieces[i + num].length <= len)
+			len -= pieces[i + num++].length;
+
+		if (len) {
+		// the piece the removal ends in goes back in without its head, starting where the removal did
+			Piece p = pieces[i + num];
+			removePieces(i, num + 1);
+			insertPiece(i, p.added, p.start + len, pos, p.length - len);
+		} else
+			removePieces(i, num);
+		starts.shift(-removed);
+
+		cache.index = i;
+		cache.start = start;
+	}
+};
+
+#define LINE_SCAN_CHUNK	(64 * 1024)	// bytes read at once when more line starts are needed
+
+// offsets of the line starts, kept in step with the edits
+// the text is read only as far as some line was asked for, so opening a big file doesn't touch all of it
+struct LineIndex {
+	OffsetArray offset;
+	int			scanned;	// the line starts up to here are known
+
+	LineIndex() : scanned(0) {}
+
+	static bool isLineBreak(char c) {
+		return c == '\r' || c == '\n';
+	}
+
+	bool complete(const TextBuffer &text) const {
+		return scanned == text.length;
+	}
+
+	int count() const {
+		return offset.count;
+	}
+
+	int operator [] (int index) const {
+		return offset[index];
+	}
+
+	void build() {
+		offset.clear();
+		offset.insert(0);
+		scanned = 0;
+	}
+
+	// reads on until every line start up to pos is known and the line after index is known too
+	void scan(const TextBuffer &text, int pos, int index) {
+		if (scanned == text.length || (scanned >= pos && index + 1 < count()))
+			return;
+
+		offset.moveGap(count());
+		TextBuffer::Iterator it = text.at(scanned);
+		while (scanned < text.length && (scanned < pos || index + 1 >= count())) {
+			int end = text.length - scanned > LINE_SCAN_CHUNK ? scanned + LINE_SCAN_CHUNK : text.length;
+			for (; scanned < end; scanned++, ++it)
+				if (isLineBreak(*it))
+					offset.insert(scanned + 1);
+		}
+	}
+
+	void scanTo(const TextBuffer &text, int pos) {
+		scan(text, pos, -1);
+	}
+
+	void scanLines(const TextBuffer &text, int index) {
+		scan(text, 0, index);
+	}
+
+	// index of the line containing pos
+	int find(int pos) const {
+		int l = 0, r = count() - 1;
+		while (l < r) {
+			int m = (l + r + 1) / 2;
+			if (offset[m] <= pos)
+				l = m;
+			else
+				r = m - 1;
+		}
+		return l;
+	}
+
+	// offset of the line break ending the line, or the text length for the last line, the next line has to be scanned
+	int end(int index, int length) const {
+		return index + 1 < count() ? offset[index + 1] - 1 : length;
+	}
+
+	// the text has to be scanned up to pos
+	void insert(const char *str, int pos, int len) {
+		offset.moveGap(find(pos) + 1);
+		for (int i = 0; i < len; i++)
+			if (isLineBreak(str[i]))
+				offset.insert(pos + i + 1);
+		offset.shift(len);
+		scanned += len;
+	}
+
+	// the text has to be scanned up to pos + len
+	void remove(int pos, int len) {
+		offset.moveGap(find(pos) + 1);
+		while (offset.tail() && offset[offset.gap] <= pos + len)
+			offset.erase(1);
+		offset.shift(-len);
+		scanned -= len;
+	}
+};
+
+#define SEARCH_QUERY	256				// longest search query
+#define SEARCH_SPLIT	(1024 * 1024)	// bytes searched per thread at least, smaller texts are searched by the caller alone
+
+inline int lowestBit(unsigned int v) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, v);
+	return i;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+
+// offsets of all matches of the search query, kept in step with the edits like the line index
+struct Search {
+	OffsetArray	matches;
+	char		query[SEARCH_QUERY];
+	int			length;
+
+	Search() : length(0) {}
+
+	int count() const {
+		return matches.count;
+	}
+
+	int operator [] (int index) const {
+		return matches[index];
+	}
+
+	void clear() {
+		matches.clear();
+		length = 0;
+	}
+
+	// index of the first match at or after pos
+	int find(int pos) const {
+		int l = 0, r = count();
+		while (l < r) {
+			int m = (l + r) / 2;
+			if (matches[m] < pos)
+				l = m + 1;
+			else
+				r = m;
+		}
+		return l;
+	}
+
+	// appends the matches lying in n contiguous bytes, base is the text offset of the first one
+	void scanBlock(const char *data, int n, int base, GapArray<int> &out) const {
+	#ifdef XEDIT_SSE2
+		scanBlockSSE2(data, n, base, out);
+		return;
+	#endif
+		scanBlockScalar(data, n, base, out);
+	}
+
+	void scanBlockScalar(const char *data, int n, int base, GapArray<int> &out) const {
+		if (n < length)
+			return;
+		const char *end = data + n - length + 1;
+		for (const char *p = data; p < end; p++) {
+			p = (const char*)memchr(p, query[0], end - p);
+			if (!p)
+				break;
+			if (!memcmp(p + 1, query + 1, length - 1))
+				out.insert(base + (int)(p - data));
+		}
+	}
+
+#ifdef XEDIT_SSE2
+	// 16 starts at once are filtered by their first and last byte, only the survivors are compared in full
+	void scanBlockSSE2(const char *data, int n, int base, GapArray<int> &out) const {
+		if (n < length)
+			return;
+		int last	= length - 1;
+		int num		= n - last;
+		__m128i f	= _mm_set1_epi8(query[0]);
+		__m128i l	= _mm_set1_epi8(query[last]);
+
+		int i = 0;
+		for (; i + 16 <= num; i += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(data + i + last));
+			unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+			while (mask) {
+				int j = i + lowestBit(mask);
+				if (length < 3 || !memcmp(data + j + 1, query + 1, length - 2))
+					out.insert(base + j);
+				mask &= mask - 1;
+			}
+		}
+		scanBlockScalar(data + i, n - i, base + i, out);
+	}
+#endif
+
+	// appends the matches starting in [from, to), the ones running across pieces are compared one by one
+	void scan(const TextBuffer &text, int from, int to, TextBuffer::Cache &cache, GapArray<int> &out) const {
+		if (to > text.length - length + 1)
+			to = text.length - length + 1;
+
+		char buf[SEARCH_QUERY];
+		for (int pos = from; pos < to; ) {
+			int start;
+			int i	= text.locate(pos, start, cache);
+			int end	= start + text.pieces[i].length;
+			int n	= (end < to + length - 1 ? end : to + length - 1) - pos;
+			scanBlock(text.pieceData(i) + pos - start, n, pos, out);
+
+			for (int p = end - length + 1 > pos ? end - length + 1 : pos; p < end && p < to; p++)
+				if (!memcmp(text.data(p, length, buf, cache), query, length))
+					out.insert(p);
+			pos = end;
+		}
+	}
+
+	// a big text is split in even ranges searched on separate threads
+	struct Split {
+		const Search		*search;
+		const TextBuffer	*text;
+		int					count;
+		GapArray<int>		*found;
+	};
+
+	static void scanChunk(void *data, int index) {
+		Split *split = (Split*)data;
+		if (index >= split->count)
+			return;
+		int length	= split->text->length;
+		int from	= (int)((long long)length * index / split->count);
+		int to		= (int)((long long)length * (index + 1) / split->count);
+		TextBuffer::Cache cache = split->text->cache;
+		split->search->scan(*split->text, from, to, cache, split->found[index]);
+	}
+
+	void scanAll(const TextBuffer &text, WorkerPool *pool) {
+		matches.clear();
+		int count = pool ? pool->count + 1 : 1;
+		if (count > text.length / SEARCH_SPLIT)
+			count = text.length / SEARCH_SPLIT;
+		if (count < 2) {
+			TextBuffer::Cache cache = text.cache;
+			scan(text, 0, text.length, cache, matches);
+			return;
+		}
+
+		Split split = { this, &text, count, new GapArray<int>[count] };
+		pool->run(scanChunk, &split);
+		for (int i = 0; i < count; i++)
+			matches.insert(split.found[i].items, split.found[i].count);
+		delete[] split.found;
+	}
+
+	// a longer query keeps the matches of the shorter one that go on with the added characters,
+	// any other query is searched for in the whole text
+	void set(const TextBuffer &text, const char *str, int len, WorkerPool *pool) {
+		if (len > SEARCH_QUERY)
+			len = SEARCH_QUERY;
+		int kept = length && len > length && !memcmp(str, query, length) ? length : 0;
+		memmove(query, str, len);
+		length = len;
+
+		if (!len)
+			matches.clear();
+		else
+			if (kept) {
+				matches.moveGap(count());
+				TextBuffer::Cache cache = text.cache;
+				char buf[SEARCH_QUERY];
+				int num = 0;
+				for (int i = 0; i < matches.count; i++) {
+					int m = matches.items[i];
+					if (m + len <= text.length && !memcmp(text.data(m + kept, len - kept, buf, cache), query + kept, len - kept))
+						matches.items[num++] = m;
+				}
+				matches.count = matches.gap = num;
+			} else
+				scanAll(text, pool);
+	}
+
+	// the text in [pos, pos + removed) was replaced by inserted bytes, matches overlapping it
+	// are dropped and the ones that may start in the new text are searched for
+	void update(const TextBuffer &text, int pos, int removed, int inserted) {
+		if (!length)
+			return;
+		int from = pos - length + 1 > 0 ? pos - length + 1 : 0;
+		matches.moveGap(find(from));
+		while (matches.tail() && matches[matches.gap] < pos + removed)
+			matches.erase(1);
+		matches.shift(inserted - removed);
+
+		TextBuffer::Cache cache = text.cache;
+		scan(text, from, pos + inserted, cache, matches);
+	}
+};
+
+#define COLUMN_STEP	4096	// bytes between the column checkpoints of a long line
+
+// columns at every COLUMN_STEP bytes of the long lines drawn so far, so a line scrolled far to the
+// right is drawn from a checkpoint near the screen instead of walking it from its start for the tabs
+struct ColumnIndex {
+	OffsetArray		offset;
+	OffsetArray		line;	// start of the line the checkpoint is in
+	GapArray<int>	column;
+
+	int count() const {
+		return offset.count;
+	}
+
+	void clear() {
+		offset.clear();
+		line.clear();
+		column.clear();
+	}
+
+	void moveGap(int index) {
+		offset.moveGap(index);
+		line.moveGap(index);
+		column.moveGap(index);
+	}
+
+	// index of the first checkpoint at or after pos
+	int find(int pos) const {
+		int l = 0, r = count();
+		while (l < r) {
+			int m = (l + r) / 2;
+			if (offset[m] < pos)
+				l = m + 1;
+			else
+				r = m;
+		}
+		return l;
+	}
+
+	// offset of the last checkpoint of the line [start, end) at or left of the target column, its column goes to col
+	// past the last checkpoint of the line the line is read on, adding checkpoints up to the first one right of the target
+	int seek(const TextBuffer &text, int start, int end, int target, int &col) {
+		int first	= find(start + 1);
+		int last	= find(end);
+		int l		= first;
+		int r		= last;
+		while (l < r) {
+			int m = (l + r) / 2;
+			if (column[m] <= target)
+				l = m + 1;
+			else
+				r = m;
+		}
+
+		int o	= l > first ? offset[l - 1] : start;
+		col		= l > first ? column[l - 1] : 0;
+		if (l < last)
+			return o;
+
+		moveGap(l);
+		int c = col;
+		TextBuffer::Iterator it = text.at(o);
+		for (int p = o, next = o + COLUMN_STEP; next < end; next += COLUMN_STEP) {
+			for (; p < next; p++, ++it)
+				c = *it == '\t' ? (c / 4 + 1) * 4 : c + 1;
+			offset.insert(next);
+			line.insert(start);
+			column.insert(c);
+			if (c > target)
+				break;
+			o	= next;
+			col	= c;
+		}
+		return o;
+	}
+
+	// column at the end of the line [start, end), a long line gets all its checkpoints on the way
+	int width(const TextBuffer &text, int start, int end) {
+		int c = 0;
+		int o = end - start > COLUMN_STEP ? seek(text, start, end, 0x7FFFFFFF, c) : start;
+		TextBuffer::Iterator it = text.at(o);
+		for (; o < end; o++, ++it)
+			c = *it == '\t' ? (c / 4 + 1) * 4 : c + 1;
+		return c;
+	}
+
+	// column of pos in the line starting at start, from the checkpoint before it if there is one
+	int columnAt(const TextBuffer &text, int start, int pos) {
+		int i = find(pos + 1);
+		int o = start, c = 0;
+		if (i > 0 && line[i - 1] == start) {
+			o = offset[i - 1];
+			c = column[i - 1];
+		}
+		TextBuffer::Iterator it = text.at(o);
+		for (; o < pos; o++, ++it)
+			c = *it == '\t' ? (c / 4 + 1) * 4 : c + 1;
+		return c;
+	}
+
+	// the text in [pos, pos + removed) was replaced by inserted bytes, checkpoints after it in its line
+	// or in lines it joins are dropped, the ones in later lines move along
+	void update(int pos, int removed, int inserted) {
+		moveGap(find(pos + 1));
+		while (line.tail() && line[line.gap] <= pos + removed) {
+			offset.erase(1);
+			line.erase(1);
+			column.erase(1);
+		}
+		offset.shift(inserted - removed);
+		line.shift(inserted - removed);
+	}
+};
+
+// text range whose cells have to be printed again, kept in step with the edits until the next layout takes it
+struct TextDamage {
+	int from, to;	// inclusive, a line is hit when the range touches it or its break, empty while from > to
+
+	TextDamage() {
+		clear();
+	}
+
+	void clear() {
+		from	= 0x7FFFFFFF;
+		to		= -1;
+	}
+
+	bool empty() const {
+		return from > to;
+	}
+
+	bool hits(int start, int end) const {
+		return start <= to && end >= from;
+	}
+
+	void add(int from, int to) {
+		if (this->from > from)	this->from = from;
+		if (this->to < to)		this->to = to;
+	}
+
+	void add(const TextDamage &damage) {
+		if (!damage.empty())
+			add(damage.from, damage.to);
+	}
+
+	// where an offset goes when the removed characters at pos are replaced by the inserted ones
+	static int shift(int offset, int pos, int removed, int inserted) {
+		if (offset <= pos)
+			return offset;
+		if (offset < pos + removed)
+			return pos;
+		return offset + inserted - removed;
+	}
+
+	void update(int pos, int removed, int inserted) {
+		if (empty())
+			return;
+		from	= shift(from, pos, removed, inserted);
+		to		= shift(to, pos, removed, inserted);
+	}
+};
+
+// built in languages, compiled into lexer tables on first use, grammars.txt can add more in the same form:
+//	language <name>
+//	files <extension>...
+//	word <class> <first characters> <next characters>			"a-z" is a range, a leading or trailing '-' itself
+//	span <class> <open> <close or eol> [<escape>] [line]		one or two character delimiters, line ends it unclosed too
+//	<class> <keyword>...										identifiers of the code class that are keywords
+//	symbol <class> after <keyword>...							the name after one of the keywords is defined in the text
+//	symbol <class> statement <keyword>...						the name before the ; ending a statement with one of them is
+// the first character of a two character opener is punctuation on its own, spans win over words starting the same
+static const char *GRAMMARS =
+	"language c++\n"
+	"files .c .cc .cpp .cxx .h .hh .hpp .hxx .inl\n"
+	"word code a-zA-Z_# a-zA-Z0-9_\n"
+	"word number 0-9 a-zA-Z0-9_.\n"
+	"span comment // eol \\\n"
+	"span comment /* */\n"
+	"span text \" \" \\ line\n"
+	"span text ' ' \\ line\n"
+	"opcode void char bool short int long float double this typedef unsigned enum union sizeof return const static struct class public private protected "
+		"virtual new delete for while do true false if else continue break switch case default\n"
+	"define NULL EOF SEEK_END SEEK_CUR SEEK_SET\n"
+	"argument #include #define #undef #if #ifdef #ifndef #elif #else #endif\n"
+	"type FILE size_t ptrdiff_t wchar_t int8_t int16_t int32_t int64_t uint8_t uint16_t uint32_t uint64_t\n"
+	"symbol type after struct class union enum\n"
+	"symbol type statement typedef\n"
+	"symbol define after #define\n"
+
+	"language shell\n"
+	"files .sh .bash .zsh .ksh\n"
+	"word code a-zA-Z_ a-zA-Z0-9_#\n"
+	"word number 0-9 0-9\n"
+	"word argument $ a-zA-Z0-9_{}?@#!*\n"
+	"span comment # eol\n"
+	"span text \" \" \\\n"
+	"span text ' '\n"
+	"opcode if then else elif fi for while until do done case esac in function return local export readonly declare break continue exit select shift set unset\n"
+	"define true false\n"
+
+	"language json\n"
+	"files .json\n"
+	"word code a-zA-Z a-zA-Z0-9\n"
+	"word number -0-9 0-9.eE+-\n"
+	"span text \" \" \\ line\n"
+	"define true false null\n"
+
+	"language yaml\n"
+	"files .yaml .yml\n"
+	"word code a-zA-Z_ -a-zA-Z0-9_./\n"
+	"word number 0-9 0-9.\n"
+	"word argument &* -a-zA-Z0-9_\n"
+	"span comment # eol\n"
+	"span text \" \" \\\n"
+	"span text ' '\n"
+	"define true false yes no on off null True False Yes No On Off Null TRUE FALSE NULL\n"
+
+	"language text\n"
+	"word code a-zA-Z_ a-zA-Z0-9_\n"
+	"word number 0-9 0-9.\n";
+
+#define GRAMMAR_RULES	16			// words and spans per language
+#define EDITOR_GUTTER	5			// columns left of the text, holding the line numbers
+#define LEX_CHUNK		(64 * 1024)	// bytes lexed ahead of what the screen needs
+#define LEX_FAR			(256 * 1024)	// bytes per extra lexer thread taken at once while the screen is far ahead
+#define LEX_THREADS		0			// threads lexing far ahead, 0 picks one per core
+#define SYMBOL_SCAN		1024		// lexemes looked back through for the start of a statement
+#define SCROLL_COLUMNS	8			// columns per sideways wheel step
+#define CHAR_FIND		6			// ctrl+f, starts typing a search query
+#define CHAR_WRAP		23			// ctrl+w, turns soft wrap on and off
+#define CHAR_DEFINITION	4			// ctrl+d, jumps to where the name under the cursor is defined
+#define CHAR_ESCAPE		27
+
+struct Editor {
+private:
+	BitFont		*font;
+	GlyphCache	**glyphs;	// one per band, the rasterizer threads don't share tiles
+	PixelFormat	tileFormat;	// the cached tiles hold pixels of this format
+	WorkerPool	*workers;
+	int			bands;
+	TextBuffer	text;
+	LineIndex	lines;
+	Search		search;
+	ColumnIndex	columns;
+	bool		wrap;		// soft wrap, long lines go on in the rows below instead of past the right edge
+	int			topRow;		// rows of the line at the top that are above the screen when wrapping
+	bool		searching;	// typed characters go to the search query
+	int			cursor;
+	Point	scroll;
+	Point	offset;
+	bool	valid;
+
+	// the lexer thread lexes what the screen shows, text, lines and syntax are shared with it under the lock
+	std::thread				lexer;
+	WorkerPool				*lexers;
+	std::mutex				lock;
+	std::condition_variable	lexWake, lexDone;
+	int						lexFrom, lexTo;	// text range on the screen
+	bool					lexQuit;
+public:
+	enum ThemeColor {
+		COLOR_CODE,
+		COLOR_TEXT,
+		COLOR_TYPE,
+		COLOR_DEFINE,
+		COLOR_NUMBER,
+		COLOR_OPCODE,
+		COLOR_COMMENT,
+		COLOR_ARGUMENT,
+		COLOR_BACK_LINE,
+		COLOR_BACK_NORMAL,
+		COLOR_BACK_SELECTION,
+		COLOR_BACK_SEARCH,
+		COLOR_CURSOR,
+		COLOR_MAX
+	};
+
+	struct Theme {
+		union {
+			struct {
+				Color byID[COLOR_MAX];
+			};
+			struct {
+				Color code;
+				Color text;
+				Color type;
+				Color define;
+				Color number;
+				Color opcode;
+				Color comment;
+				Color argument;
+				Color back_line;
+				Color back_normal;
+				Color back_selection;
+				Color back_search;
+				Color cursor;
+			};
+		};
+	} theme;
+
+	struct Syntax {
+
+		struct Lexeme {
+			enum ID { 
+				ID_CODE, ID_TEXT, ID_TYPE, ID_DEFINE, ID_NUMBER, ID_OPCODE, ID_COMMENT, ID_ARGUMENT, ID_MAX
+			} id;
+			int	offset;
+			int	length;
+		};
+
+	// lexemes are kept as separate arrays, 9 bytes per token, reused between parses
+		struct Lexemes {
+			GapArray<unsigned char>	id;
+			OffsetArray				offset;
+			GapArray<int>			length;
+
+			int count() const {
+				return offset.count;
+			}
+
+			int gap() const {
+				return offset.gap;
+			}
+
+			int tail() const {
+				return offset.tail();
+			}
+
+			Lexeme operator [] (int index) const {
+				Lexeme lex = { (Lexeme::ID)id[index], offset[index], length[index] };
+				return lex;
+			}
+
+			void clear() {
+				id.clear();
+				offset.clear();
+				length.clear();
+			}
+
+			void moveGap(int index) {
+				id.moveGap(index);
+				offset.moveGap(index);
+				length.moveGap(index);
+			}
+
+			void insert(Lexeme::ID id, int offset, int length) {
+				this->id.insert(id);
+				this->offset.insert(offset);
+				this->length.insert(length);
+			}
+
+			void erase(int num) {
+				id.erase(num);
+				offset.erase(num);
+				length.erase(num);
+			}
+
+		// appends the lexemes of another array from index on, its gap has to be at the end
+			void append(const Lexemes &src, int from) {
+				int num = src.count() - from;
+				id.insert(&src.id.items[from], num);
+				offset.insert(&src.offset.items[from], num);
+				length.insert(&src.length.items[from], num);
+			}
+		} lexemes;
+
+	// open addressing hash of keyword names, looked up by (pointer, length) straight from the text
+		struct Keywords {
+			struct Entry {
+				char			*str;
+				unsigned int	hash;
+				unsigned char	length;
+				unsigned char	id;
+			} *table;
+			int mask, count, maxLength;
+
+			Keywords() : table(NULL), mask(-1), count(0), maxLength(0) {}
+
+			~Keywords() {
+				for (int i = 0; i <= mask; i++)
+					if (table[i].str) delete[] table[i].str;
+				delete[] table;
+			}
+
+			static unsigned int hash(const char *str, int length) {
+				unsigned int h = 2166136261U;
+				for (int i = 0; i < length; i++)
+					h = (h ^ (unsigned char)str[i]) * 16777619U;
+				return h;
+			}
+
+			Entry* find(const char *str, int length, unsigned int h) const {
+				for (int i = h & mask; ; i = (i + 1) & mask) {
+					Entry &e = table[i];
+					if (!e.str || (e.hash == h && e.length == length && !memcmp(e.str, str, length)))
+						return &e;
+				}
+			}
+
+			int get(const char *str, int length) const {
+				if (length > maxLength)
+					return -1;
+				Entry *e = find(str, length, hash(str, length));
+				return e->str ? e->id : -1;
+			}
+
+			void grow() {
+				Entry *old = table;
+				int size = mask + 1;
+				mask = size ? size * 2 - 1 : 255;
+				table = new Entry[mask + 1];
+				memset(table, 0, (mask + 1) * sizeof(Entry));
+				for (int i = 0; i < size; i++)
+					if (old[i].str)
+						*find(old[i].str, old[i].length, old[i].hash) = old[i];
+				delete[] old;
+			}
+
+		// the first class a name was added with wins
+			void add(const char *str, int id) {
+				int length = strlen(str);
+				if (!length || length > 255)
+					return;
+				if ((count + 1) * 2 > mask + 1)
+					grow();
+
+				unsigned int h = hash(str, length);
+				Entry *e = find(str, length, h);
+				if (e->str)
+					return;
+
+				e->str = new char[length + 1];
+				memcpy(e->str, str, length + 1);
+				e->hash		= h;
+				e->length	= length;
+				e->id		= id;
+				count++;
+				if (maxLength < length)
+					maxLength = length;
+			}
+
+		// lexeme class by its name in keyword and grammar files, -1 if it isn't one
+			static int classOf(const char *name) {
+				const char *classes[] = { "code", "text", "type", "define", "number", "opcode", "comment", "argument" };
+				for (int i = 0; i < (int)(sizeof(classes) / sizeof(classes[0])); i++)
+					if (!strcmp(name, classes[i]))
+						return i;
+				return -1;
+			}
+
+		// user keywords, one class per line followed by its names: "type Vec3 Mat4"
+			bool load(const char *name) {
+				FILE *f = fopen(name, "rb");
+				if (!f) return false;
+
+				char line[1024];
+				while (fgets(line, sizeof(line), f)) {
+					int id = -1;
+					for (char *str = strtok(line, " \t\r\n"); str; str = strtok(NULL, " \t\r\n"))
+						if (id == -1) {
+							id = classOf(str);
+							if (id == -1) break;
+						} else
+							add(str, id);
+				}
+				fclose(f);
+				return true;
+			}
+		} keywords;	// the user's, looked up after the ones of the language
+
+	// a DFA compiled from a grammar, a row of 256 transitions per state, each with the next state in the low byte
+	// and what happens to the lexemes and lines above it, most bytes only change the state, a lexeme is open in
+	// the word and span states and in no other, so the actions know without looking
+		struct Language {
+			enum Action {
+				ACTION_NONE,
+				ACTION_END,			// the open lexeme ends before the byte
+				ACTION_BEGIN,		// one of the class begins at the byte
+				ACTION_END_BEGIN,	// the open lexeme ends and one of the class begins at the byte
+				ACTION_BEGIN_BACK,	// one of the class begins at the byte before, the second of a two byte opener
+				ACTION_END_AFTER,	// the open lexeme ends after the byte
+				ACTION_PUNCT,		// the byte is a code lexeme of its own
+				ACTION_END_PUNCT,	// the open lexeme ends and the byte is a code lexeme of its own
+			};
+
+			enum {
+				TRANSITION_FLUSH	= 0x8000,	// the byte before is punctuation, the opener it started didn't follow
+				TRANSITION_LINE		= 0x10000	// the byte is a line break
+			};
+
+			enum {
+				SYMBOL_STATEMENT	= 0x80	// the name is the one before the ; of the statement, not the one after
+			};
+
+			struct Word {
+				int		id;
+				bool	first[256];
+				bool	next[256];
+			};
+
+			struct Span {
+				int		id;
+				char	open[3];
+				char	close[3];	// empty ends before the line break
+				char	escape;		// the byte after it never closes
+				bool	line;		// ends unclosed before a line break
+			};
+
+			char			name[32];
+			char			files[256];	// extensions, each with a space on both sides
+			Word			words[GRAMMAR_RULES];
+			Span			spans[GRAMMAR_RULES];
+			int				wordCount, spanCount;
+			Keywords		keywords;
+			Keywords		definers;	// keywords telling a name is defined and its class, flagged for statements
+			unsigned int	*table;
+			int				states;
+			int				prefixes;	// the states from this on hold the first byte of a two byte opener
+			bool			cuts[256];	// bytes after which lexing is in a breakable state whatever the state before
+			Language		*next;
+
+			Language(const char *name, Language *next) : wordCount(0), spanCount(0), table(NULL), states(0), prefixes(0), next(next) {
+				snprintf(this->name, sizeof(this->name), "%s", name);
+				strcpy(files, " ");
+			}
+
+			~Language() {
+				delete[] table;
+			}
+
+			static unsigned int transition(int state, Action action, int id) {
+				return state | id << 8 | action << 12;
+			}
+
+		// a long line can get a checkpoint in the state, it is neither in a word nor after a byte
+		// whose lexeme the next byte decides, which would begin before the checkpoint
+			bool breakable(int state) const {
+				return (state == 0 || state > wordCount) && state < prefixes;
+			}
+
+			static void parseSet(const char *str, bool *set) {
+				memset(set, 0, 256 * sizeof(bool));
+				for (const unsigned char *c = (const unsigned char*)str; *c; c++)
+					if (c[1] == '-' && c[2]) {
+						for (int i = c[0]; i <= c[2]; i++)
+							set[i] = true;
+						c += 2;
+					} else
+						set[*c] = true;
+			}
+
+		// one rule or keyword line split in words, false if it isn't understood
+			bool parse(char **args, int count) {
+				if (!strcmp(args[0], "files")) {
+					for (int i = 1; i < count; i++)
+						if (strlen(files) + strlen(args[i]) + 2 < sizeof(files)) {
+							strcat(files, args[i]);
+							strcat(files, " ");
+						}
+					return true;
+				}
+
+				int id = count > 1 ? Keywords::classOf(args[1]) : -1;
+				if (!strcmp(args[0], "symbol")) {
+					if (count > 3 && !strcmp(args[2], "statement"))
+						id |= SYMBOL_STATEMENT;
+					else if (count < 4 || strcmp(args[2], "after"))
+						return false;
+					if (id == -1)
+						return false;
+					for (int i = 3; i < count; i++)
+						definers.add(args[i], id);
+					return true;
+				}
+
+				if (!strcmp(args[0], "word")) {
+					if (id == -1 || count != 4 || wordCount == GRAMMAR_RULES)
+						return false;
+					Word &w = words[wordCount++];
+					w.id = id;
+					parseSet(args[2], w.first);
+					parseSet(args[3], w.next);
+					w.next['\r'] = w.next['\n'] = false;
+					return true;
+				}
+
+				if (!strcmp(args[0], "span")) {
+					const char *close = count > 3 && strcmp(args[3], "eol") ? args[3] : "";
+					if (id == -1 || count < 4 || spanCount == GRAMMAR_RULES || strlen(args[2]) > 2 || strlen(close) > 2)
+						return false;
+					Span &s = spans[spanCount++];
+					s.id		= id;
+					s.escape	= '\0';
+					s.line		= false;
+					strcpy(s.open, args[2]);
+					strcpy(s.close, close);
+					for (int i = 4; i < count; i++)
+						if (!strcmp(args[i], "line"))
+							s.line = true;
+						else
+							s.escape = args[i][0];
+					return true;
+				}
+
+				id = Keywords::classOf(args[0]);
+				if (id == -1)
+					return false;
+				for (int i = 1; i < count; i++)
+					keywords.add(args[i], id);
+				return true;
+			}
+
+		// states: 0 between lexemes, one per word, per span its body, the byte after its escape and the first
+		// byte of a two byte close, and one per first byte of the two byte openers
+			void build() {
+				int word[GRAMMAR_RULES], body[GRAMMAR_RULES], escape[GRAMMAR_RULES], close[GRAMMAR_RULES], prefix[256];
+				states = 1;
+				for (int k = 0; k < wordCount; k++)
+					word[k] = states++;
+				for (int k = 0; k < spanCount; k++) {
+					body[k]		= states++;
+					escape[k]	= spans[k].escape ? states++ : -1;
+					close[k]	= spans[k].close[0] && spans[k].close[1] ? states++ : -1;
+				}
+				for (int c = 0; c < 256; c++)
+					prefix[c] = -1;
+				prefixes = states;
+				for (int k = 0; k < spanCount; k++)
+					if (spans[k].open[1] && prefix[(unsigned char)spans[k].open[0]] == -1)
+						prefix[(unsigned char)spans[k].open[0]] = states++;
+
+				delete[] table;
+				table = new unsigned int[states * 256];
+
+			// the earlier rules win, so they are laid down last
+				unsigned int *start = table;
+				for (int c = 0; c < 256; c++)
+					start[c] = transition(0, (c == ' ' || c == '\t' || LineIndex::isLineBreak(c)) ? ACTION_NONE : ACTION_PUNCT, Lexeme::ID_CODE);
+				for (int k = wordCount - 1; k >= 0; k--)
+					for (int c = 0; c < 256; c++)
+						if (words[k].first[c])
+							start[c] = transition(word[k], ACTION_BEGIN, words[k].id);
+				for (int k = spanCount - 1; k >= 0; k--) {
+					unsigned char c = spans[k].open[0];
+					start[c] = spans[k].open[1] ? transition(prefix[c], ACTION_NONE, 0) : transition(body[k], ACTION_BEGIN, spans[k].id);
+				}
+
+			// a word ends on any other byte, which is taken as if it came between lexemes
+				for (int k = 0; k < wordCount; k++) {
+					unsigned int *row = &table[word[k] * 256];
+					for (int c = 0; c < 256; c++) {
+						int action = start[c] >> 12;
+						if (words[k].next[c])
+							row[c] = transition(word[k], ACTION_NONE, 0);
+						else
+							row[c] = (start[c] & 0xFFF) | (action == ACTION_BEGIN ? ACTION_END_BEGIN : action == ACTION_PUNCT ? ACTION_END_PUNCT : ACTION_END) << 12;
+					}
+				}
+
+				for (int k = 0; k < spanCount; k++) {
+					const Span &s = spans[k];
+					unsigned int *row = &table[body[k] * 256];
+					for (int c = 0; c < 256; c++)
+						row[c] = (LineIndex::isLineBreak(c) && (s.line || !s.close[0])) ? transition(0, ACTION_END, 0) : transition(body[k], ACTION_NONE, 0);
+					if (s.close[0])
+						row[(unsigned char)s.close[0]] = s.close[1] ? transition(close[k], ACTION_NONE, 0) : transition(0, ACTION_END_AFTER, 0);
+					if (s.escape)
+						row[(unsigned char)s.escape] = transition(escape[k], ACTION_NONE, 0);
+
+				// an escaped \r\n is one line break
+					if (escape[k] != -1) {
+						unsigned int *esc = &table[escape[k] * 256];
+						for (int c = 0; c < 256; c++)
+							esc[c] = transition(c == '\r' ? escape[k] : body[k], ACTION_NONE, 0);
+					}
+
+					if (close[k] != -1) {
+						unsigned int *second = &table[close[k] * 256];
+						memcpy(second, row, 256 * sizeof(unsigned int));
+						second[(unsigned char)s.close[1]] = transition(0, ACTION_END_AFTER, 0);
+					}
+				}
+
+			// the byte after a possible opener, which is punctuation unless the opener is complete
+				for (int p = 0; p < 256; p++) {
+					if (prefix[p] == -1)
+						continue;
+					unsigned int *row = &table[prefix[p] * 256];
+					for (int c = 0; c < 256; c++)
+						row[c] = start[c] | TRANSITION_FLUSH;
+					for (int k = spanCount - 1; k >= 0; k--)
+						if ((unsigned char)spans[k].open[0] == p && spans[k].open[1])
+							row[(unsigned char)spans[k].open[1]] = transition(body[k], ACTION_BEGIN_BACK, spans[k].id);
+				}
+
+				for (int i = 0; i < states; i++) {
+					table[i * 256 + '\r'] |= TRANSITION_LINE;
+					table[i * 256 + '\n'] |= TRANSITION_LINE;
+				}
+
+				for (int c = 0; c < 256; c++) {
+					cuts[c] = true;
+					for (int i = 0; i < states; i++)
+						if (!breakable(table[i * 256 + c] & 0xFF))
+							cuts[c] = false;
+				}
+			}
+
+		// the languages described in the source, put in front of the list, with a message for lines it doesn't understand
+			static Language* compile(const char *source, Language *list) {
+				Language *first = list;
+				char *copy = new char[strlen(source) + 1];
+				strcpy(copy, source);
+
+				int number = 0;
+				for (char *line = copy, *end; *line; line = end) {
+					end = line + strcspn(line, "\n");
+					if (*end)
+						*end++ = '\0';
+					number++;
+
+					char *args[256];
+					int count = 0;
+					for (char *str = strtok(line, " \t\r"); str && count < 256; str = strtok(NULL, " \t\r"))
+						args[count++] = str;
+					if (!count)
+						continue;
+
+					if (!strcmp(args[0], "language") && count == 2) {
+						if (list != first)
+							list->build();
+						list = new Language(args[1], list);
+					} else
+						if (list == first || !list->parse(args, count))
+							printf("grammar line %d isn't understood: %s\n", number, args[0]);
+				}
+				if (list != first)
+					list->build();
+
+				delete[] copy;
+				return list;
+			}
+
+		// the built in languages and the ones from grammars.txt in front of them, so they can take extensions over
+			static Language* all() {
+				static Language *list = NULL;
+				if (!list) {
+					list = compile(GRAMMARS, NULL);
+					FILE *f = fopen("grammars.txt", "rb");
+					if (f) {
+						fseek(f, 0, SEEK_END);
+						int size = ftell(f);
+						fseek(f, 0, SEEK_SET);
+						char *source = new char[size + 1];
+						source[fread(source, 1, size, f)] = '\0';
+						fclose(f);
+						list = compile(source, list);
+						delete[] source;
+					}
+				}
+				return list;
+			}
+
+			static Language* named(const char *name) {
+				for (Language *l = all(); l; l = l->next)
+					if (!strcmp(l->name, name))
+						return l;
+				return NULL;
+			}
+
+		// by the extension of the file name, plain text if none matches
+			static Language* find(const char *fileName) {
+				const char *dot = strrchr(fileName, '.');
+				if (dot && !strpbrk(dot, "/\\") && strlen(dot) < 30) {
+					char ext[32];
+					snprintf(ext, sizeof(ext), " %s ", dot);
+					for (char *c = ext; *c; c++)
+						if (*c >= 'A' && *c <= 'Z')
+							*c += 'a' - 'A';
+					for (Language *l = all(); l; l = l->next)
+						if (strstr(l->files, ext))
+							return l;
+				}
+				return named("text");
+			}
+		};
+
+		const Language	*language;
+
+	// lexer state at the start of a line or a checkpoint inside a long one, enough to resume lexing from there
+		struct State {
+			unsigned char	state;	// of the language DFA
+			bool			open;
+
+			bool operator == (const State &s) const {
+				return state == s.state && open == s.open;
+			}
+		};
+
+		struct Lines {
+			OffsetArray		offset;
+			GapArray<State>	state;
+
+			int count() const {
+				return offset.count;
+			}
+
+			int gap() const {
+				return offset.gap;
+			}
+
+			int tail() const {
+				return offset.tail();
+			}
+
+			void clear() {
+				offset.clear();
+				state.clear();
+			}
+
+			void moveGap(int index) {
+				offset.moveGap(index);
+				state.moveGap(index);
+			}
+
+			void insert(int offset, const State &state) {
+				this->offset.insert(offset);
+				this->state.insert(state);
+			}
+
+			void erase(int num) {
+				offset.erase(num);
+				state.erase(num);
+			}
+
+			void append(const Lines &src, int num) {
+				offset.insert(src.offset.items, num);
+				state.insert(src.state.items, num);
+			}
+		} lines;
+
+	// names defined in the text itself, found among the lexemes by the symbol rules of the language as they
+	// are lexed, the definitions are sorted by offset behind a gap like the lexemes, so an edit only touches
+	// the ones lexed again, each points at its name in a hash and each name back at where one of them is kept,
+	// so both the class of a name and where it's defined are found in constant time
+		struct Symbols {
+			struct Name {
+				char			*str;
+				unsigned int	hash;
+				unsigned char	length;
+				int				count;	// definitions in the text, the name has no class without any
+				int				first;	// link of the earliest of them, which gives the name its class, the next spare name without any
+			};
+
+		// the definitions of a name are chained through links that stay put while the definitions move
+			struct Link {
+				int				slot;		// where the definition is in the arrays, which are in text order
+				int				prev, next;	// other definitions of the same name, -1 at the ends, next chains the unused links
+				unsigned char	id;			// class the definition tells
+				bool			statement;	// found from the ; ending a statement, not from a keyword before the name
+			};
+
+			GapArray<Name>	names;		// the gap stays at the end, so the definitions keep their index
+			int				*table;		// open addressing hash of name indices, -1 where free
+			int				mask, maxLength;
+			OffsetArray		offset;		// of each definition in the text
+			GapArray<int>	name;		// of each definition
+			GapArray<int>	link;		// of each definition
+			GapArray<Link>	links;		// the gap stays at the end
+			int				unused;		// first unused link, -1 if there's none
+			int				spare;		// first name whose last definition went, taken by the next new one, -1 if there's none
+			bool			changed;	// a name got its first definition, lost its last one or changed its class
+
+			Symbols() : table(NULL), mask(-1), maxLength(0), unused(-1), spare(-1), changed(false) {}
+
+			~Symbols() {
+				clear();
+				delete[] table;
+			}
+
+			int count() const {
+				return offset.count;
+			}
+
+			int gap() const {
+				return offset.gap;
+			}
+
+			int tail() const {
+				return offset.tail();
+			}
+
+			void clear() {
+				for (int i = 0; i < names.count; i++)
+					delete[] names.items[i].str;
+				names.clear();
+				for (int i = 0; i <= mask; i++)
+					table[i] = -1;
+				maxLength = 0;
+				offset.clear();
+				name.clear();
+				link.clear();
+				links.clear();
+				unused	= -1;
+				spare	= -1;
+			}
+
+			int* find(const char *str, int length, unsigned int h) const {
+				for (int i = h & mask; ; i = (i + 1) & mask) {
+					int k = table[i];
+					if (k == -1)
+						return &table[i];
+					const Name &n = names.items[k];
+					if (n.hash == h && n.length == length && !memcmp(n.str, str, length))
+						return &table[i];
+				}
+			}
+
+			void grow() {
+				int *old = table;
+				int size = mask + 1;
+				mask = size ? size * 2 - 1 : 255;
+				table = new int[mask + 1];
+				for (int i = 0; i <= mask; i++)
+					table[i] = -1;
+				for (int i = 0; i < size; i++)
+					if (old[i] != -1)
+						*find(names.items[old[i]].str, names.items[old[i]].length, names.items[old[i]].hash) = old[i];
+				delete[] old;
+			}
+
+		// index of the name, added if it's new, -1 if it's too long
+			int add(const char *str, int length) {
+				if (length > 255)
+					return -1;
+				if ((names.count + 1) * 2 > mask + 1)
+					grow();
+
+				unsigned int h = Keywords::hash(str, length);
+				int *k = find(str, length, h);
+				if (*k == -1) {
+					Name n = { new char[length], h, (unsigned char)length, 0, -1 };
+					memcpy(n.str, str, length);
+					if (spare != -1) {
+						*k = spare;
+						spare = names.items[spare].first;
+						names.items[*k] = n;
+					} else {
+						*k = names.count;
+						names.insert(n);
+					}
+					if (maxLength < length)
+						maxLength = length;
+				}
+				return *k;
+			}
+
+		// takes the name without definitions out of the hash and keeps its slot for the next new one, the names
+		// after it in its run of the hash that could be where it was move up, so no run has a hole
+			void release(int index) {
+				Name &n = names.items[index];
+				int i = (int)(find(n.str, n.length, n.hash) - table);
+				for (int j = (i + 1) & mask; table[j] != -1; j = (j + 1) & mask) {
+					int home = names.items[table[j]].hash & mask;
+					if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+						table[i] = table[j];
+						i = j;
+					}
+				}
+				table[i] = -1;
+
+				delete[] n.str;
+				n.str	= NULL;
+				n.first	= spare;
+				spare	= index;
+			}
+
+		// class of a name with definitions, -1 for any other
+			int get(const char *str, int length) const {
+				if (length > maxLength)
+					return -1;
+				int k = *find(str, length, Keywords::hash(str, length));
+				return k != -1 && names.items[k].count ? links.items[names.items[k].first].id : -1;
+			}
+
+		// text offset of the earliest definition of the name, -1 if there's none
+			int locate(const char *str, int length) {
+				if (length > maxLength)
+					return -1;
+				int k = *find(str, length, Keywords::hash(str, length));
+				if (k == -1 || !names.items[k].count)
+					return -1;
+				int slot = links.items[names.items[k].first].slot;
+				return slot < gap() ? offset.items[slot] : offset.items[slot] + offset.delta;
+			}
+
+		// index of the first definition at or after pos
+			int findDefinition(int pos) const {
+				int l = 0, r = count();
+				while (l < r) {
+					int m = (l + r) / 2;
+					if (offset[m] < pos)
+						l = m + 1;
+					else
+						r = m;
+				}
+				return l;
+			}
+
+		// a definition went to another place in the arrays
+			void moved(int slot) {
+				links.items[link.items[slot]].slot = slot;
+			}
+
+			void moveGap(int index) {
+				int size = offset.capacity - offset.count;
+				int from = offset.gap;
+				offset.moveGap(index);
+				name.moveGap(index);
+				link.moveGap(index);
+				if (index < from)
+					for (int i = index; i < from; i++)
+						moved(i + size);
+				else
+					for (int i = from; i < index; i++)
+						moved(i);
+			}
+
+			void insert(int pos, int index, int id, bool statement) {
+				int l = unused;
+				if (l != -1)
+					unused = links.items[l].next;
+				else {
+					Link k;
+					links.insert(k);
+					l = links.count - 1;
+				}
+
+				int capacity = offset.capacity;
+				offset.insert(pos);
+				name.insert(index);
+				link.insert(l);
+			// the ones after the gap went to the end of the bigger arrays
+				if (capacity != offset.capacity)
+					for (int i = offset.capacity - offset.tail(); i < offset.capacity; i++)
+						moved(i);
+
+				Name &n = names.items[index];
+				Link &k = links.items[l];
+				k.slot		= offset.gap - 1;
+				k.id		= (unsigned char)id;
+				k.statement	= statement;
+				n.count++;
+				if (n.first == -1 || k.slot < links.items[n.first].slot) {
+					if (n.first == -1 || links.items[n.first].id != k.id)
+						changed = true;
+					lead(n, l);
+				} else
+					chain(n.first, l);
+			}
+
+		// puts the link right after the one at before in the chain
+			void chain(int before, int l) {
+				Link &k = links.items[l];
+				k.prev = before;
+				k.next = links.items[before].next;
+				if (k.next != -1)
+					links.items[k.next].prev = l;
+				links.items[before].next = l;
+			}
+
+		// puts the link of the earliest definition of the name at the start of the chain
+			void lead(Name &n, int l) {
+				Link &k = links.items[l];
+				k.prev = -1;
+				k.next = n.first;
+				if (n.first != -1)
+					links.items[n.first].prev = l;
+				n.first = l;
+			}
+
+			void unchain(Name &n, int l) {
+				Link &k = links.items[l];
+				if (k.prev != -1)
+					links.items[k.prev].next = k.next;
+				else
+					n.first = k.next;
+				if (k.next != -1)
+					links.items[k.next].prev = k.prev;
+			}
+
+			bool byStatement(int index) const {
+				return links.items[link[index]].statement;
+			}
+
+		// removes definitions right after the gap
+			void erase(int num) {
+				for (int i = 0; i < num; i++) {
+					int slot = offset.gap + offset.capacity - offset.count;
+					int l = link.items[slot];
+					int index = name.items[slot];
+					Name &n = names.items[index];
+					bool earliest = n.first == l;
+					unchain(n, l);
+					links.items[l].next	= unused;
+					unused				= l;
+
+					if (!--n.count) {
+						release(index);
+						changed = true;
+					} else if (earliest) {
+					// the next earliest definition gives the name its class now
+						int m = n.first;
+						for (int j = links.items[m].next; j != -1; j = links.items[j].next)
+							if (links.items[j].slot < links.items[m].slot)
+								m = j;
+						if (m != n.first) {
+							unchain(n, m);
+							lead(n, m);
+						}
+						if (links.items[m].id != links.items[l].id)
+							changed = true;
+					}
+					offset.erase(1);
+					name.erase(1);
+					link.erase(1);
+				}
+			}
+		} symbols;
+
+		int					lexed;		// the text from this checkpoint on isn't lexed yet, the last line checkpoint is here
+		std::atomic<bool>	yield;		// set by another thread waiting for the text, lexing stops at the next checkpoint
+		TextDamage			recolored;	// text whose lexemes changed since the editor last took it
+
+		Syntax() : language(Language::named("c++")), lexed(0), yield(false) {
+			reset();
+		}
+		
+	// index of the last line starting at or before pos
+		int findLine(int pos) const {
+			int l = 0, r = lines.count() - 1;
+			while (l < r) {
+				int m = (l + r + 1) / 2;
+				if (lines.offset[m] <= pos)
+					l = m;
+				else
+					r = m - 1;
+			}
+			return l;
+		}
+
+	// index of the first lexeme starting at or after pos
+		int findLexeme(int pos) const {
+			int l = 0, r = lexemes.count();
+			while (l < r) {
+				int m = (l + r) / 2;
+				if (lexemes.offset[m] < pos)
+					l = m + 1;
+				else
+					r = m;
+			}
+			return l;
+		}
+
+	// lexing always happens at the gap, the lexeme right before it is the current one
+		bool lexemeOpen() const {
+			int i = lexemes.gap() - 1;
+			return i >= 0 && !lexemes.length[i];
+		}
+
+		void lexemeEnd(int pos) {
+			if (lexemeOpen())
+				lexemeClose(pos);
+		};
+
+	// ends the lexeme known to be open
+		void lexemeClose(int pos) {
+			int i = lexemes.gap() - 1;
+			lexemes.length.items[i] = pos - lexemes.offset.items[i];
+		}
+
+	// lexes from the checkpoint at pos in the given state until the end of text, until a checkpoint
+	// past syncPos is reached in the same state as the old one behind the gap (shifted by delta),
+	// or until the first checkpoint at or after limit, where the lexed part of the text ends
+	// returns the sync position or -1
+		int lex(const TextBuffer &text, int pos, const State &state, int syncPos, int delta, int limit) {
+			const unsigned int *table = language->table;
+			int		current	= state.state;
+			int		length	= text.length;
+			bool	newLine	= true;
+			int		next	= pos;	// where a long line gets its next checkpoint
+
+			TextBuffer::Cache cache = text.cache;
+			TextBuffer::Iterator it = text.at(pos, cache);
+			for (int i = pos; i < length; i++, ++it) {
+				if (newLine || (i >= next && language->breakable(current))) {
+					State s = { (unsigned char)current, lexemeOpen() };
+					while (lines.tail() && lines.offset[lines.gap()] + delta < i)
+						lines.erase(1);
+					if (lines.tail() && lines.offset[lines.gap()] + delta == i) {
+						if (i > syncPos && lines.state[lines.gap()] == s)
+							return i;
+						lines.erase(1);
+					}
+					lines.insert(i, s);
+
+				// the checkpoint keeps the open lexeme flag, the lexeme gets reopened when lexing goes on
+					if (i >= limit || yield) {
+						lexemeEnd(i);
+						lexed = i;
+						return -1;
+					}
+
+				// a long line gets one every chunk, or sooner at the limit and where the old one is to sync with
+					next = i + LEX_CHUNK;
+					if (limit > i && limit < next)
+						next = limit;
+					if (lines.tail() && lines.offset[lines.gap()] + delta < next)
+						next = lines.offset[lines.gap()] + delta;
+				}
+
+			// the bytes that only change the state are run through straight from the piece, up to the
+			// next one that does more or the end of the piece, whose transition is handled here, the row
+			// stays the same inside words and spans so its loads don't wait on each other
+				const unsigned char *p = (const unsigned char*)it.ptr;
+				const unsigned int *row = &table[current * 256];
+				int run = (int)(it.end - it.ptr) - 1;
+				if (i < next && run > next - i - 1)
+					run = next - i - 1;
+				int k = 0;
+				unsigned int t = row[p[0]];
+				while (t < 256 && k < run) {
+					if (t != (unsigned int)current) {
+						current = t;
+						row = &table[t * 256];
+					}
+					t = row[p[++k]];
+				}
+				i		+= k;
+				it.ptr	+= k;
+
+				current = t & 0xFF;
+				newLine = (t & Language::TRANSITION_LINE) != 0;
+				if (t >> 8) {
+					if (t & Language::TRANSITION_FLUSH)
+						lexemes.insert(Lexeme::ID_CODE, i - 1, 1);
+					Lexeme::ID id = (Lexeme::ID)(t >> 8 & 15);
+					switch (t >> 12 & 7) {
+					case Language::ACTION_END:
+						lexemeClose(i);
+						break;
+					case Language::ACTION_BEGIN:
+						lexemes.insert(id, i, 0);
+						break;
+					case Language::ACTION_END_BEGIN:
+						lexemeClose(i);
+						lexemes.insert(id, i, 0);
+						break;
+					case Language::ACTION_BEGIN_BACK:
+						lexemes.insert(id, i - 1, 0);
+						break;
+					case Language::ACTION_END_AFTER:
+						lexemeClose(i + 1);
+						break;
+					case Language::ACTION_PUNCT:
+						lexemes.insert(Lexeme::ID_CODE, i, 1);
+						break;
+					case Language::ACTION_END_PUNCT:
+						lexemeClose(i);
+						lexemes.insert(Lexeme::ID_CODE, i, 1);
+						break;
+					}
+				}
+			}
+
+			if (newLine) {
+				State s = { (unsigned char)current, lexemeOpen() };
+				lines.insert(length, s);
+			}
+
+			lexemeEnd(length);
+			lexed = length;
+			return -1;
+		}
+
+	// only identifiers can be keywords, strings, numbers and comments start with other characters
+		void classify(const TextBuffer &text, int from, int to) {
+			TextBuffer::Cache cache = text.cache;
+			char buf[256];
+			const Keywords &own = language->keywords;
+			int maxLength = own.maxLength > keywords.maxLength ? own.maxLength : keywords.maxLength;
+			for (int i = from; i < to; i++) {
+				int length = lexemes.length[i];
+				if (lexemes.id[i] != Lexeme::ID_CODE || length > maxLength)
+					continue;
+
+				const char *str = text.data(lexemes.offset[i], length, buf, cache);
+				int id = own.get(str, length);
+				if (id == -1)
+					id = keywords.get(str, length);
+				if (id != -1)
+					lexemes.id[i] = id;
+			};
+		}
+
+	// the byte of a punctuation lexeme, '\0' for any other
+		char punctuation(const TextBuffer &text, int index, TextBuffer::Cache &cache) const {
+			if (lexemes.id[index] != Lexeme::ID_CODE || lexemes.length[index] != 1)
+				return '\0';
+			char buf;
+			return *text.data(lexemes.offset[index], 1, &buf, cache);
+		}
+
+	// an unclassified word starting like the words of the code class
+		bool isName(const TextBuffer &text, int index, TextBuffer::Cache &cache) const {
+			if (lexemes.id[index] != Lexeme::ID_CODE)
+				return false;
+			char buf;
+			unsigned char c = *text.data(lexemes.offset[index], 1, &buf, cache);
+			for (int i = 0; i < language->wordCount; i++)
+				if (language->words[i].id == Lexeme::ID_CODE && language->words[i].first[c])
+					return true;
+			return false;
+		}
+
+	// the symbol rule of a keyword lexeme, -1 if it has none
+		int rule(const TextBuffer &text, int index, TextBuffer::Cache &cache) const {
+			int id		= lexemes.id[index];
+			int length	= lexemes.length[index];
+			if (id == Lexeme::ID_CODE || id == Lexeme::ID_TEXT || id == Lexeme::ID_COMMENT || id == Lexeme::ID_NUMBER || length > language->definers.maxLength)
+				return -1;
+			char buf[256];
+			return language->definers.get(text.data(lexemes.offset[index], length, buf, cache), length);
+		}
+
+	// class a statement ending at the lexeme defines the name before it with, going back over the braces
+	// in it, so the names of typedef struct { ... } Name; and typedef int Name; are both found
+		int statement(const TextBuffer &text, int end, TextBuffer::Cache &cache) const {
+			int depth = 0;
+			for (int i = end - 1; i >= 0 && i >= end - SYMBOL_SCAN; i--) {
+				char c = punctuation(text, i, cache);
+				if (c == '}')
+					depth++;
+				else if (c == '{') {
+					if (!depth--)
+						return -1;
+				} else if (c == ';') {
+					if (!depth)
+						return -1;
+				} else if (!depth) {
+					int id = rule(text, i, cache);
+					if (id != -1 && (id & Language::SYMBOL_STATEMENT))
+						return id & ~Language::SYMBOL_STATEMENT;
+				}
+			}
+			return -1;
+		}
+
+	// adds the name lexeme to the symbols at their gap, false if it's too long to be one
+		bool define(const TextBuffer &text, int name, int id, bool statement, TextBuffer::Cache &cache) {
+			char buf[256];
+			int offset = lexemes.offset[name];
+			int length = lexemes.length[name];
+			int k = length < (int)sizeof(buf) ? symbols.add(text.data(offset, length, buf, cache), length) : -1;
+			if (k == -1)
+				return false;
+			symbols.insert(offset, k, id, statement);
+			return true;
+		}
+
+	// the definition of the name before the ; at index, the old one is dropped unless a keyword told it,
+	// found gives whether the statement defining it still reaches back far enough
+		void retell(const TextBuffer &text, int index, bool found, TextBuffer::Cache &cache) {
+			int name = index - 1;
+			while (lexemes.id[name] == Lexeme::ID_COMMENT)
+				name--;
+			int offset = lexemes.offset[name];
+			while (symbols.tail() && symbols.offset[symbols.gap()] < offset)
+				symbols.moveGap(symbols.gap() + 1);
+			if (symbols.tail() && symbols.offset[symbols.gap()] == offset) {
+				if (!symbols.byStatement(symbols.gap()))
+					return;
+				symbols.erase(1);
+			}
+			int id = found && isName(text, name, cache) ? statement(text, name, cache) : -1;
+			if (id != -1)
+				define(text, name, id, true, cache);
+		}
+
+	// the lexeme after the comments from index on and the one after it, the end of the lexemes if there's none
+		int skipComments(int index) const {
+			while (index < lexemes.count() && lexemes.id[index] == Lexeme::ID_COMMENT)
+				index++;
+			return index < lexemes.count() ? index + 1 : index;
+		}
+
+	// the definitions of the names in the lexemes [first, end) at the symbols' gap are gone, they were lexed
+	// again and get found again, returns the lexeme of the last definition still kept before them
+		int drop(int first, int end) {
+			int limit = end < lexemes.count() ? lexemes.offset[end] : 0x7FFFFFFF;
+			while (symbols.tail() && symbols.offset[symbols.gap()] < limit)
+				symbols.erase(1);
+
+		// the lexeme right before them may be a name too, told by a keyword before it, which stays,
+		// or by a ; in them, which may be gone
+			int last = first - 1;
+			if (symbols.gap() && symbols.offset[symbols.gap() - 1] >= lexemes.offset[first]) {
+				last = findLexeme(symbols.offset[symbols.gap() - 1]);
+				if (symbols.byStatement(symbols.gap() - 1)) {
+					symbols.moveGap(symbols.gap() - 1);
+					symbols.erase(1);
+					last = first - 1;
+				}
+			}
+			return last;
+		}
+
+	// adds the names the lexemes [first, stop) tell to the symbols at their gap, a keyword tells the name after it
+	// and a ; the name before it if a statement keyword comes before that, only names in (last, end) are taken,
+	// returns the last statement keyword so far, -1 if there's none within reach
+		int collect(const TextBuffer &text, int first, int end, int stop, int last, TextBuffer::Cache &cache) {
+			int semicolon	= -1;	// where the next ; in the text is
+			int opener		= -1;	// only with one a ; is looked at
+			for (int i = first - 1; i >= 0 && i >= first - SYMBOL_SCAN && opener == -1; i--) {
+				int id = rule(text, i, cache);
+				if (id != -1 && (id & Language::SYMBOL_STATEMENT))
+					opener = i;
+			}
+
+			for (int i = first; i < stop; i++) {
+				int id = -1, name = -1;
+				int at = lexemes.offset[i];
+				if (opener != -1 && at > semicolon)
+					semicolon = text.find(';', at, cache);
+				bool statement = at == semicolon && opener >= i - SYMBOL_SCAN && punctuation(text, i, cache) == ';';
+				if (statement) {
+					name = i - 1;
+					while (name > first && lexemes.id[name] == Lexeme::ID_COMMENT)
+						name--;
+					if (name > last && name < end && isName(text, name, cache))
+						id = this->statement(text, name, cache);
+				} else {
+					id = rule(text, i, cache);
+					if (id == -1)
+						continue;
+					if (id & Language::SYMBOL_STATEMENT) {
+						opener = i;
+						continue;
+					}
+					name = i + 1;
+					while (name < end && lexemes.id[name] == Lexeme::ID_COMMENT)
+						name++;
+					if (name >= end || name <= last || !isName(text, name, cache))
+						id = -1;
+				}
+				if (id != -1 && define(text, name, id, statement, cache))
+					last = name;
+			}
+			return opener;
+		}
+
+	// the lexemes from stop on are the old ones, but a ; among them tells its name from a keyword it finds by
+	// looking back, which can now be in the lexemes before stop or gone from them, so such a ; tells its name again
+	//  - the look back stops at a ; or a { of its own level of braces, so the first ; is the only one that can get
+	//    past stop on its level, and each } closing a level opened before stop starts a lower level with a first ;
+	//  - a statement keyword on the level ends it too, the ; after it find that one
+	//  - the walk is over once no statement keyword is within reach behind it and no name told by a ; is ahead
+		void follow(const TextBuffer &text, int stop, int opener, TextBuffer::Cache &cache) {
+			int keyword	= opener;	// the last statement keyword up to stop
+			int reach	= stop + SYMBOL_SCAN < lexemes.count() ? lexemes.offset[stop + SYMBOL_SCAN] : 0x7FFFFFFF;
+			int told	= -1;		// offset of the last name told by a ; within reach
+			for (int i = symbols.gap(); i < symbols.count() && symbols.offset[i] < reach; i++)
+				if (symbols.byStatement(i))
+					told = symbols.offset[i];
+
+			int depth = 0, floor = 0;
+			bool blocked = false;	// the first ; of the level is past
+			for (int i = stop, name = stop - 1; i < lexemes.count() && name < stop + SYMBOL_SCAN; i++) {
+				if ((keyword == -1 || keyword < name - SYMBOL_SCAN) && lexemes.offset[name] > told)
+					break;
+				char c = punctuation(text, i, cache);
+				if (c == '{')
+					depth++;
+				else if (c == '}') {
+					if (--depth < floor) {
+						floor	= depth;
+						blocked	= false;
+					}
+				} else if (c == ';') {
+					if (depth == floor && !blocked) {
+						retell(text, i, opener != -1 && opener >= i - SYMBOL_SCAN, cache);
+						blocked = true;
+					}
+				} else {
+					int id = rule(text, i, cache);
+					if (id != -1 && (id & Language::SYMBOL_STATEMENT)) {
+						opener = i;
+						if (depth == floor)
+							blocked = true;
+					}
+				}
+				if (lexemes.id[i] != Lexeme::ID_COMMENT)
+					name = i;
+			}
+		}
+
+	// finds the definitions again after the lexemes [from, to) were lexed again, the symbols' gap is where they
+	// start, a name can be told by the lexeme before them, one after them by the last of them, and its ; after it
+		void index(const TextBuffer &text, int from, int to) {
+			if (!language->definers.count)
+				return;
+			TextBuffer::Cache cache = text.cache;
+			int first = from - 1;
+			while (first > 0 && lexemes.id[first] == Lexeme::ID_COMMENT)
+				first--;
+			if (first < 0)
+				first = 0;
+			int end		= skipComments(to);
+			int stop	= skipComments(end);
+
+			int last	= drop(first, end);
+			int opener	= collect(text, first, end, stop, last, cache);
+			follow(text, stop, opener, cache);
+		}
+
+	// a name got or lost its class, which shows wherever it's used
+		void recolor() {
+			if (symbols.changed)
+				recolored.add(0, lexed);
+			symbols.changed = false;
+		}
+
+	// the class a lexeme is drawn with, names defined in the text get theirs from the symbols as they are
+	// drawn, so a new definition colors the name everywhere without lexing it again
+		int lexemeClass(const TextBuffer &text, int index, TextBuffer::Cache &cache) const {
+			int id		= lexemes.id[index];
+			int length	= lexemes.length[index];
+			if (id != Lexeme::ID_CODE || length > symbols.maxLength)
+				return id;
+			char buf[256];
+			int symbol = symbols.get(text.data(lexemes.offset[index], length, buf, cache), length);
+			return symbol != -1 ? symbol : id;
+		}
+
+	// forgets everything, the text gets lexed on demand from the checkpoint at its start
+		void reset() {
+			lexemes.clear();
+			lines.clear();
+			symbols.clear();
+
+			State state = { 0, false };
+			lines.insert(0, state);
+			lexed = 0;
+			recolored.clear();
+		}
+
+		void parse(const TextBuffer &text, WorkerPool *pool = NULL) {
+			reset();
+			extend(text, text.length, pool);
+		};
+
+	// the lexeme still open at a checkpoint continues, lex it again as unclassified
+		Lexeme reopen(int index) {
+			Lexeme lex = lexemes[index];
+			lexemes.length[index] = 0;
+			if (lex.id == Lexeme::ID_OPCODE || lex.id == Lexeme::ID_DEFINE || lex.id == Lexeme::ID_ARGUMENT || lex.id == Lexeme::ID_TYPE)
+				lexemes.id[index] = Lexeme::ID_CODE;
+			return lex;
+		}
+
+	// lexes on from the end of the lexed part up to the checkpoint after pos, and a chunk more
+		void extend(const TextBuffer &text, int pos) {
+			if (lexed == text.length || lexed > pos)
+				return;
+
+			int line	= lines.count() - 1;
+			State state	= lines.state[line];
+			int first	= lexemes.count();
+
+			lines.moveGap(line);
+			lines.erase(1);
+			lexemes.moveGap(first);
+
+			int from = lexed;
+			if (state.open)
+				from = reopen(first - 1).offset;
+
+			int limit = text.length - pos > LEX_CHUNK ? pos + LEX_CHUNK : text.length;
+			lex(text, lexed, state, text.length, 0, limit);
+			classify(text, state.open ? first - 1 : first, lexemes.gap());
+			recolored.add(from, lexed - 1);
+
+			symbols.moveGap(symbols.count());
+			index(text, first, lexemes.gap());
+			recolor();
+		}
+
+	// first line start at or after pos, or in a long line the first place after it where lexing
+	// gets a checkpoint whatever the state, so a chunk ending there ends right on it
+		int chunkStart(const TextBuffer &text, int pos, TextBuffer::Cache &cache) const {
+			if (pos <= 0)
+				return 0;
+			int cut = -1;
+			TextBuffer::Iterator it = text.at(pos - 1, cache);
+			for (int i = pos - 1; i < text.length; i++, ++it) {
+				unsigned char c = *it;
+				if (LineIndex::isLineBreak(c))
+					return i + 1;
+				if (cut == -1 && language->cuts[c])
+					cut = i + 1;
+				if (cut != -1 && i - pos >= LEX_CHUNK)
+					return cut;
+			}
+			return text.length;
+		}
+
+	// chunks of the text starting at checkpoints, lexed on separate threads into a syntax each
+		struct Split {
+			const TextBuffer	*text;
+			Syntax				*owner;
+			Syntax				*parts;
+			int					count;
+			int					*start;	// count + 1 checkpoints bounding the chunks
+			int					*first;	// count + 1 lexeme indices bounding the chunks once they are merged
+		};
+
+	// the guess is that no comment, string or lexeme is open at the chunk start, which holds for most lines
+		static void lexChunk(void *data, int index) {
+			Split *split = (Split*)data;
+			if (index >= split->count)
+				return;
+			Syntax &part	= split->parts[index];
+			State state		= { 0, false };
+			part.lines.clear();
+			part.lex(*split->text, split->start[index], state, split->text->length, 0, split->start[index + 1]);
+		}
+
+		static void classifyChunk(void *data, int index) {
+			Split *split = (Split*)data;
+			if (index < split->count)
+				split->owner->classify(*split->text, split->first[index], split->first[index + 1]);
+		}
+
+	// lexes the chunk [start, end) held by this syntax again from its real entry state, with the lexeme
+	// open there if any, the guessed lexemes are kept from the first checkpoint where both states agree
+		void relex(const TextBuffer &text, int start, int end, const State &state, const Lexeme &open) {
+			lines.moveGap(0);
+			lines.erase(1);
+			lexemes.moveGap(0);
+			if (state.open)
+				lexemes.insert(open.id, open.offset, 0);
+
+			int sync = lex(text, start, state, start, 0, end);
+			int last = lexemes.gap();
+			if (sync != -1) {
+				Lexeme prev = { Lexeme::ID_CODE, 0, 0 };
+				while (lexemes.tail() && lexemes.offset[lexemes.gap()] < sync) {
+					prev = lexemes[lexemes.gap()];
+					lexemes.erase(1);
+				}
+
+				if (lines.state[lines.gap()].open && prev.length)
+					lexemes.length[last - 1] = prev.offset + prev.length - lexemes.offset[last - 1];
+			} else {
+				lexemes.erase(lexemes.tail());
+				lines.erase(lines.tail());
+			}
+		}
+
+	// lexes on like extend, but a long way is split in chunks lexed on all threads of the pool at once,
+	// then the chunks that guessed their entry state wrong get lexed again in order until they sync
+	// with the guess, which leaves the same lexemes and checkpoints as lexing all of it in one go
+		void extend(const TextBuffer &text, int pos, WorkerPool *pool) {
+			if (lexed == text.length || lexed > pos)
+				return;
+
+			PROFILE_SCOPE(STAGE_PARSE);
+			TextBuffer::Cache cache = text.cache;
+			int end		= chunkStart(text, text.length - pos > LEX_CHUNK ? pos + LEX_CHUNK : text.length, cache);
+			int count	= pool ? pool->count + 1 : 1;
+			if (count > (end - lexed) / LEX_CHUNK)
+				count = (end - lexed) / LEX_CHUNK;
+			if (count < 2) {
+				extend(text, pos);
+				return;
+			}
+
+			int *start = new int[count * 2 + 2];
+			int *first = start + count + 1;
+			int n = 1;
+			start[0] = lexed;
+			for (int i = 1; i < count; i++) {
+				int p = chunkStart(text, lexed + (int)((long long)(end - lexed) * i / count), cache);
+				if (p > start[n - 1] && p < end)
+					start[n++] = p;
+			}
+			start[n] = end;
+
+			Split split = { &text, this, new Syntax[n], n, start, first };
+			for (int i = 0; i < n; i++)
+				split.parts[i].language = language;
+			pool->run(lexChunk, &split);
+
+			int line	= lines.count() - 1;
+			int from	= lexed;
+			State state	= lines.state[line];
+			Lexeme open	= { Lexeme::ID_CODE, 0, 0 };
+			lines.moveGap(line);
+			lines.erase(1);
+			lexemes.moveGap(lexemes.count());
+			if (state.open) {
+				open = reopen(lexemes.count() - 1);
+				from = open.offset;
+			}
+
+			State guess = { 0, false };
+			for (int i = 0; i < n; i++) {
+				Syntax &part = split.parts[i];
+				if (!(state == guess))
+					part.relex(text, start[i], start[i + 1], state, open);
+				state = part.lines.state[part.lines.count() - 1];
+				if (state.open)
+					open = part.lexemes[part.lexemes.count() - 1];
+			}
+
+		// chunks share the checkpoint where one ends and the next starts, the lexeme open there is merged
+			for (int i = 0; i < n; i++) {
+				Syntax &part = split.parts[i];
+				part.lines.moveGap(part.lines.count());
+				part.lexemes.moveGap(part.lexemes.count());
+				lines.append(part.lines, i + 1 < n ? part.lines.count() - 1 : part.lines.count());
+
+				first[i] = lexemes.count();
+				int skip = part.lines.state[0].open ? 1 : 0;
+				if (skip) {
+					lexemes.length[first[i] - 1] = part.lexemes.length[0];
+					if (!i)
+						first[i]--;
+				}
+				lexemes.append(part.lexemes, skip);
+			}
+			first[n] = lexemes.count();
+			lexed = end;
+			recolored.add(from, lexed - 1);
+
+			pool->run(classifyChunk, &split);
+			symbols.moveGap(symbols.count());
+			index(text, first[0], first[n]);
+			recolor();
+			delete[] split.parts;
+			delete[] start;
+		}
+
+	// re-lexes the text after [pos, pos + removed) was replaced by inserted bytes, starting from
+	// the nearest line checkpoint and reusing the old lexemes once the lexer state converges
+		void update(const TextBuffer &text, int pos, int removed, int inserted) {
+			int delta	= inserted - removed;
+			bool whole	= lexed == text.length - delta;
+			recolored.update(pos, removed, inserted);
+
+		// nothing to do past the lexed part, the checkpoint where it ends only depends on the text before
+			if (!whole && pos >= lexed)
+				return;
+
+			PROFILE_SCOPE(STAGE_PARSE);
+			int line	= findLine(pos);
+			int start	= lines.offset[line];
+			State state	= lines.state[line];
+			int first	= findLexeme(start);
+
+		// the old lines and lexemes past the checkpoint wait behind the gaps until the lexer syncs with them
+			lines.moveGap(line);
+			lines.erase(1);
+			lexemes.moveGap(first);
+			symbols.moveGap(symbols.findDefinition(start));
+
+			Lexeme reopened = { Lexeme::ID_CODE, 0, 0 };
+			if (state.open)
+				reopened = reopen(first - 1);
+
+		// in a partly lexed text the old lines only go as far as the old end of the lexed part,
+		// and if the lexer doesn't sync within a chunk the rest is left to the lexer thread
+			int end		= lexed + delta;
+			int limit	= whole ? text.length : (end > pos + inserted ? end : pos + inserted);
+			if (limit - (pos + inserted) > LEX_CHUNK)
+				limit = pos + inserted + LEX_CHUNK;
+			int sync	= lex(text, start, state, pos + inserted, delta, limit);
+			int fresh	= state.open ? first - 1 : first;
+			int last	= lexemes.gap();
+
+			if (sync != -1) {
+				Lexeme prev = reopened;
+				while (lexemes.tail() && lexemes.offset[lexemes.gap()] < sync - delta) {
+					prev = lexemes[lexemes.gap()];
+					lexemes.erase(1);
+				}
+
+				if (lines.state[lines.gap()].open && prev.length)
+					lexemes.length[last - 1] = prev.offset + prev.length + delta - lexemes.offset[last - 1];
+				while (symbols.tail() && symbols.offset[symbols.gap()] < sync - delta)
+					symbols.erase(1);
+				lexed = end;
+			} else {
+				lexemes.erase(lexemes.tail());
+				lines.erase(lines.tail());
+				symbols.erase(symbols.tail());
+			}
+
+			lexemes.offset.shift(delta);
+			lines.offset.shift(delta);
+			symbols.offset.shift(delta);
+
+			classify(text, fresh, last);
+			index(text, fresh, last);
+			recolor();
+
+		// past the sync the lexemes are the old ones, without it the rest of the old lexed part is unlexed now
+			recolored.add(state.open ? reopened.offset : start, (sync != -1 ? sync : (end > lexed ? end : lexed)) - 1);
+		}
+
+	} syntax;
+
+	struct Cell {
+		union {
+			struct {
+				int	id;
+			};
+			struct {
+				char	c;
+				char	fColor;
+				char	bColor;
+				char	reserved;
+			};
+		};
+	} *cells;	// the shown cells, followed by the rows the next layout prints
+	int	cols, rows;
+	int	*spans;	// first and last changed column of each row in the last rasterized frame, -1 if none
+
+	unsigned char	*dirty;			// rows the next layout prints again, the others keep their cells
+	TextDamage		damage;			// lines the next layout prints again
+	int				shownCursor;	// where the shown cells have the cursor
+
+	ThemeColor	fColor, bColor;
+
+	void	(*onLexed)(void *data);	// called on the lexer thread when text on the screen got its colors
+	void	*onLexedData;
+
+	Editor(const Theme &theme) : glyphs(NULL), tileFormat(FORMAT_32), workers(NULL), bands(0), wrap(false), topRow(0), searching(false), cursor(0), scroll(0, 0), offset(0, 0), valid(false), lexers(NULL), lexFrom(0), lexTo(0), lexQuit(false), theme(theme), cells(NULL), cols(0), rows(0), spans(NULL), dirty(NULL), shownCursor(0), onLexed(NULL), onLexedData(NULL) {
+		font = new BitFont("font.dat");
+		setThreads(RENDER_THREADS);
+		syntax.keywords.load("keywords.txt");
+		load(NULL, 0);
+		int cores = LEX_THREADS ? LEX_THREADS : std::thread::hardware_concurrency();
+		lexers = new WorkerPool(cores > 1 ? cores - 1 : 0);
+		lexer = std::thread(&Editor::lexLoop, this);
+	}
+
+	// takes ownership of the malloc'ed data
+	void load(char *data, int size) {
+		lockText();
+		text.load(data, size);
+		reset();
+		unlockText();
+	}
+
+	// the file is mapped, lines and lexemes are only worked out as far as the screen shows them
+	bool open(const char *name) {
+		lockText();
+		bool done = text.map(name);
+		if (done) {
+			syntax.language = Syntax::Language::find(name);
+			reset();
+		}
+		unlockText();
+		return done;
+	}
+
+	// the lexer thread gives the lock up at its next checkpoint
+	void lockText() {
+		syntax.yield = true;
+		lock.lock();
+		syntax.yield = false;
+	}
+
+	void unlockText() {
+		lock.unlock();
+		lexWake.notify_one();
+	}
+
+	// lexes a chunk at a time while the screen shows text that isn't lexed yet
+	void lexLoop() {
+		std::unique_lock<std::mutex> l(lock);
+		while (true) {
+			while (!lexQuit && (syntax.yield || syntax.lexed >= lexTo || syntax.lexed == text.length))
+				lexWake.wait(l);
+			if (lexQuit)
+				return;
+
+		// far from the screen the chunks get bigger and are split among the lexer threads
+			int from	= syntax.lexed;
+			int far		= from + LEX_FAR * lexers->count;
+			syntax.extend(text, lexTo > far ? far : from, lexers);
+			bool shown = from < lexTo && syntax.lexed > lexFrom;
+			lexDone.notify_all();
+
+			if (shown && onLexed) {
+				l.unlock();
+				onLexed(onLexedData);
+				l.lock();
+			}
+		}
+	}
+
+	// blocks until the text on the screen is lexed
+	void waitLexed() {
+		std::unique_lock<std::mutex> l(lock);
+		while (syntax.lexed < lexTo && syntax.lexed < text.length)
+			lexDone.wait(l);
+	}
+
+	void reset() {
+		lines.build();
+		syntax.reset();
+		search.clear();
+		columns.clear();
+		cursor	= 0;
+		scroll	= Point(0, 0);
+		offset	= Point(0, 0);
+		redraw();
+	}
+
+	~Editor() { 
+		lockText();
+		lexQuit = true;
+		unlockText();
+		lexer.join();
+		delete lexers;
+
+		delete font;
+		delete workers;
+		for (int i = 0; i < bands; i++)
+			delete glyphs[i];
+		delete[] glyphs;
+		if (cells) free(cells);
+		if (spans) free(spans);
+		if (dirty) free(dirty);
+	}
+
+	// rows are rasterized in bands, one per thread, 0 picks one per core
+	void setThreads(int count) {
+		if (count <= 0)
+			count = std::thread::hardware_concurrency();
+		if (count <= 0)
+			count = 1;
+		if (count == bands)
+			return;
+
+		delete workers;
+		for (int i = 0; i < bands; i++)
+			delete glyphs[i];
+		delete[] glyphs;
+
+		bands	= count;
+		glyphs	= new GlyphCache*[bands];
+		for (int i = 0; i < bands; i++)
+			glyphs[i] = new GlyphCache(GLYPH_CACHE_BUDGET);
+		workers	= new WorkerPool(bands - 1);
+	}
+
+	void insert(int pos, const char *str, int len) {
+		lines.scanTo(text, pos);
+		int count	= lines.count();
+		int height	= wrap ? wrapRows(lines.find(pos)) : 1;
+		text.insert(pos, str, len);
+		lines.insert(str, pos, len);
+		syntax.update(text, pos, 0, len);
+		search.update(text, pos, 0, len);
+		columns.update(pos, 0, len);
+		touch(pos, 0, len, count, height);
+	}
+
+	void remove(int pos, int len) {
+		if (len > text.length - pos)
+			len = text.length - pos;
+		lines.scanTo(text, pos + len);
+		int count	= lines.count();
+		int height	= wrap ? wrapRows(lines.find(pos)) : 1;
+		text.remove(pos, len);
+		lines.remove(pos, len);
+		syntax.update(text, pos, len, 0);
+		search.update(text, pos, len, 0);
+		columns.update(pos, len, 0);
+		touch(pos, len, 0, count, height);
+	}
+
+	// an edit only prints its own line again, unless the lines below move up or down
+	void touch(int pos, int removed, int inserted, int count, int height) {
+		damage.update(pos, removed, inserted);
+		shownCursor = TextDamage::shift(shownCursor, pos, removed, inserted);
+
+		bool moved = lines.count() != count || (wrap && wrapRows(lines.find(pos)) != height);
+		damage.add(pos, moved ? text.length : pos + inserted);
+	}
+
+	void invalidate(const Rect &rect) {
+		valid = false;
+	}
+
+	// marks the shown cells as unknown so every cell gets drawn again
+	void redraw() {
+		for (int i = 0; i < cols * rows; i++)
+			cells[i].reserved = 1;
+		for (int r = 0; r < rows; r++)
+			dirty[r] = 1;
+		valid = false;
+	}
+
+	void setTheme(const Theme &theme) {
+		this->theme = theme;
+		for (int i = 0; i < bands; i++)
+			glyphs[i]->clear();
+		redraw();
+	}
+
+	void moveLine(int dir) {
+		lines.scanTo(text, cursor);
+		int line	= lines.find(cursor);
+		int column	= cursor - lines[line];
+
+		line += dir;
+		lines.scanLines(text, line);
+		if (line < 0 || line >= lines.count())
+			return;
+
+		int end = lines.end(line, text.length);
+		cursor = lines[line] + column < end ? lines[line] + column : end;
+	}
+
+	void setCursor(int pos) {
+		cursor = pos < 0 ? 0 : (pos > text.length ? text.length : pos);
+		valid = false;
+	}
+
+	// highlights all matches of the query, an empty one clears them
+	void find(const char *query, int length) {
+		lockText();
+		search.set(text, query, length, workers);
+		damage.add(0, text.length);
+		unlockText();
+		valid = false;
+	}
+
+	// scrolls the cursor a third down the screen when it's off it, with the text locked
+	void scrollToCursor() {
+		lines.scanTo(text, cursor);
+		int line = lines.find(cursor);
+		if (!wrap) {
+			int row = line + scroll.y + offset.y;
+			if (row < 0 || row >= rows - 1)
+				offset.y += rows / 3 - row;
+		} else
+			if (cursor < lexFrom || cursor >= lexTo) {
+			// with soft wrap the cursor goes a third down the screen from its own row
+				scroll.y	= -line;
+				topRow		= columns.columnAt(text, lines[line], cursor) / wrapWidth();
+				offset.y	= 0;
+				scrollRows(rows / 3);
+				redraw();
+			}
+	}
+
+	// moves the cursor to the next match after it, from the top past the last one, and scrolls to it
+	void findNext() {
+		lockText();
+		if (search.count()) {
+			int i = search.find(cursor + 1);
+			cursor = search[i < search.count() ? i : 0];
+			scrollToCursor();
+		}
+		unlockText();
+		valid = false;
+	}
+
+	// moves the cursor to the earliest definition of the name and scrolls to it, false if the text has none,
+	// the text is only lexed as far as it's shown, so the rest of it is lexed on until one is found
+	bool gotoDefinition(const char *name, int length) {
+		lockText();
+		int pos = syntax.symbols.locate(name, length);
+		while (pos == -1 && syntax.lexed < text.length) {
+			syntax.extend(text, syntax.lexed + LEX_FAR * lexers->count, lexers);
+			pos = syntax.symbols.locate(name, length);
+		}
+		if (pos != -1) {
+			cursor = pos;
+			scrollToCursor();
+		}
+		unlockText();
+		valid = false;
+		return pos != -1;
+	}
+
+	// the name the cursor is in or right after
+	bool gotoDefinition() {
+		char name[256];
+		int length = 0;
+		lockText();
+		int i = syntax.findLexeme(cursor + 1) - 1;
+		if (i >= 0) {
+			Syntax::Lexeme lex = syntax.lexemes[i];
+			if (cursor <= lex.offset + lex.length && lex.length < (int)sizeof(name))
+				length = text.copy(lex.offset, lex.length, name);
+		}
+		unlockText();
+		return length && gotoDefinition(name, length);
+	}
+
+	// ctrl+f types a query, enter jumps to the next match, escape stops typing and a second one clears the matches,
+	// which stay highlighted and up to date while editing in between
+	void onSearchChar(unsigned char c) {
+		char query[SEARCH_QUERY];
+		memcpy(query, search.query, search.length);
+
+		if (c == CHAR_FIND)
+			searching = true;
+		else
+			if (c == CHAR_ESCAPE) {
+				if (!searching)
+					find(NULL, 0);
+				else
+					if (rows)
+						dirty[rows - 1] = 1;
+				searching = false;
+			} else
+				if (c == '\r')
+					findNext();
+				else
+					if (c >= ' ' && search.length < SEARCH_QUERY) {
+						query[search.length] = c;
+						find(query, search.length + 1);
+					}
+		valid = false;
+	}
+
+	void onKey(int key) {
+		if (searching && key == VK_BACK) {
+			if (search.length)
+				find(search.query, search.length - 1);
+			return;
+		}
+
+		lockText();
+		if (key == VK_LEFT)		if (cursor > 0) cursor--;
+		if (key == VK_RIGHT)	if (cursor < text.length) cursor++;
+		if (key == VK_UP)		moveLine(-1);
+		if (key == VK_DOWN)		moveLine(+1);
+		if (key == VK_BACK)		if (cursor > 0) remove(--cursor, 1);
+		unlockText();
+
+		valid = false;
+	};
+
+	void onChar(unsigned char c) {
+		if (c == CHAR_WRAP) {
+			setWrap(!wrap);
+			return;
+		}
+		if (c == CHAR_DEFINITION && !searching) {
+			gotoDefinition();
+			return;
+		}
+	#ifdef XEDIT_PROFILE
+		if (c == CHAR_PROFILE) {
+			profiler.hud = !profiler.hud;
+			redraw();
+			return;
+		}
+	#endif
+		if (searching || c == CHAR_FIND || c == CHAR_ESCAPE) {
+			onSearchChar(c);
+			return;
+		}
+		if (c < ' ' && c != '\r' && c != '\t')
+			return;
+
+		char ch = c;
+		lockText();
+		insert(cursor++, &ch, 1);
+		unlockText();
+
+		valid = false;
+	};
+
+	void onScroll(int x, int y) {
+		offset.x += x;
+		offset.y += y;
+		valid = false;
+	}
+
+	void resize(int width, int height) {
+		int c = (width + 8) / 9;
+		int r = (height + 15) / 16;
+
+		if (rows != r) {
+			spans = (int*)realloc(spans, 2 * r * sizeof(spans[0]));
+			dirty = (unsigned char*)realloc(dirty, r);
+		}
+
+		if (cols * rows != c * r) {
+			cells = (Cell*)realloc(cells, 2 * c * r * sizeof(cells[0]));
+			for (int i = 0; i < 2 * c * r; i++) {
+				cells[i].c			= '\0';
+				cells[i].bColor		= COLOR_BACK_NORMAL;
+				cells[i].bColor		= COLOR_BACK_NORMAL;
+				cells[i].reserved	= 1;
+			}
+			valid = false;
+		}
+	// a new size comes with new canvas pixels, everything is drawn again
+		bool changed = cols != c || rows != r;
+
+	// with soft wrap the first character on the screen stays at the top
+		if (wrap && c != cols && scroll.y <= 0 && topRow) {
+			lockText();
+			int line = -scroll.y;
+			int column = 0;
+			lines.scanLines(text, line);
+			if (line < lines.count())
+				wrapStart(lines[line], lines.end(line, text.length), topRow, column);
+			cols	= c;
+			topRow	= column / wrapWidth();
+			unlockText();
+		}
+
+		cols = c;
+		rows = r;
+		if (changed)
+			redraw();
+	};
+
+	void putChar(int x, int y, unsigned char c) {
+		if (x < 0 || y < 0 || x >= cols || y >= rows)
+			return;
+
+		Cell &cell = cells[x + y * cols + cols * rows];
+
+		if (cell.c == c && cell.fColor == fColor && cell.bColor == bColor)
+			return;
+
+		cell.c		= c;
+		cell.fColor	= fColor;
+		cell.bColor	= bColor;
+	};
+
+	void print(int ox, int &x, int &y, char c) {
+		switch (c) {
+			case '\n' :
+			//	break;
+			case '\r' :
+				x = scroll.x;
+				y++;
+				break;
+			case '\t' :
+				x = ((x - scroll.x) / 4 + 1) * 4 + scroll.x;
+				break;
+			default :
+				if (x >= 0)
+					putChar(ox + x, y, c);
+				x++;
+		}
+	}
+
+	void print(int ox, int &x, int &y, ThemeColor fColor, ThemeColor bColor, const char *text, int length) {
+		if (!length) return;
+
+		this->fColor = fColor;
+		this->bColor = bColor;
+
+		for (int i = 0; i < length; i++)
+			print(ox, x, y, text[i]);
+	}
+
+	template <class F>
+	void drawGlyph(GlyphCache *cache, unsigned char c, ThemeColor fColor, ThemeColor bColor, typename F::Pixel *pixel, int stride) {
+		typedef typename F::Pixel Pixel;
+		if (theme.byID[bColor] == COLOR_CLEAR) {
+			font->putChar<F>(c, theme.byID[fColor], theme.byID[bColor], pixel, stride);
+			return;
+		}
+
+		bool fresh;
+		Pixel *tile = (Pixel*)cache->get(c | fColor << 8 | bColor << 16, fresh);
+		if (fresh)
+			font->putChar<F>(c, theme.byID[fColor], theme.byID[bColor], tile, 9 * sizeof(Pixel));
+		GlyphCache::draw(tile, pixel, stride);
+	}
+
+	// moves the shown cells and their dirty rows along with the canvas pixels, only the uncovered cells are left to print and draw
+	void scrollCells(Canvas *canvas, int ox, int dx, int dy) {
+		Cell *c = cells;
+
+		if (dy) {
+			int n = rows - abs(dy);
+			if (n > 0) {
+				if (dy > 0) {
+					memmove(&c[dy * cols], &c[0], n * cols * sizeof(Cell));
+					memmove(&dirty[dy], &dirty[0], n);
+				} else {
+					memmove(&c[0], &c[-dy * cols], n * cols * sizeof(Cell));
+					memmove(&dirty[0], &dirty[-dy], n);
+				}
+				canvas->scrollY(Rect(0, 0, cols * 9, rows * 16), dy * 16);
+			} else
+				n = 0;
+
+			int from = dy > 0 ? 0 : n;
+			for (int i = from * cols; i < (from + rows - n) * cols; i++)
+				c[i].reserved = 1;
+			for (int r = from; r < from + rows - n; r++)
+				dirty[r] = 1;
+
+		// the search bar stays at the bottom, the row it got moved to shows text again
+			if (searching && rows - 1 + dy >= 0 && rows - 1 + dy < rows)
+				dirty[rows - 1 + dy] = 1;
+		}
+
+		if (dx) {
+			int width = cols - ox;
+			int n = width - abs(dx);
+			if (n < 0) n = 0;
+			int from = dx > 0 ? 0 : n;
+
+			for (int r = 0; r < rows; r++) {
+				Cell *row = &c[r * cols + ox];
+				if (dx > 0)
+					memmove(&row[dx], &row[0], n * sizeof(Cell));
+				else
+					memmove(&row[0], &row[-dx], n * sizeof(Cell));
+				for (int i = from; i < from + width - n; i++)
+					row[i].reserved = 1;
+				dirty[r] = 1;
+			}
+
+			if (n)
+				canvas->scrollX(Rect(ox * 9, 0, cols * 9, rows * 16), dx * 9);
+		}
+	}
+
+	// a frame is the pending scroll, the cell layout and the rasterization of the changed cells
+	void render(Canvas *canvas) {
+		applyScroll(canvas);
+
+		if (!valid) {
+			{
+				PROFILE_SCOPE(STAGE_LAYOUT);
+				layout();
+			}
+			PROFILE_SCOPE(STAGE_RASTER);
+			rasterize(canvas);
+		}
+	#ifdef XEDIT_PROFILE
+		drawProfile(canvas);
+	#endif
+	}
+
+	void applyScroll(Canvas *canvas) {
+		if (wrap)
+			offset.x = 0;
+		if (offset.x || offset.y) {
+			scrollCells(canvas, EDITOR_GUTTER, offset.x, offset.y);
+			scroll.x += offset.x;
+			lockText();
+			scrollRows(offset.y);
+			unlockText();
+			offset = Point(0, 0);
+		}
+	}
+
+	// text columns a row holds with soft wrap, a multiple of the tab width so the tab stops are the same in every row
+	int wrapWidth() const {
+		int width = (cols - EDITOR_GUTTER) & ~3;
+		return width > 4 ? width : 4;
+	}
+
+	// rows a line wraps into, a character goes to the row its column falls in, so a row
+	// only depends on the columns in the line and the index of long lines finds it
+	int wrapRows(int line) {
+		lines.scanLines(text, line);
+		if (line < 0 || line >= lines.count())
+			return 1;
+		int width = columns.width(text, lines[line], lines.end(line, text.length));
+		return width ? (width + wrapWidth() - 1) / wrapWidth() : 1;
+	}
+
+	// first character of a row of the line [start, end) and its column
+	int wrapStart(int start, int end, int row, int &column) {
+		int target = row * wrapWidth();
+		int i = start;
+		column = 0;
+		if (end - start > COLUMN_STEP)
+			i = columns.seek(text, start, end, target, column);
+		TextBuffer::Iterator it = text.at(i);
+		for (; i < end && column < target; i++, ++it)
+			column = *it == '\t' ? (column / 4 + 1) * 4 : column + 1;
+		return i;
+	}
+
+	// moves the top of the screen down by -dy rows or up by dy, with soft wrap through the rows of the lines on the way
+	void scrollRows(int dy) {
+		if (!wrap) {
+			scroll.y += dy;
+			return;
+		}
+
+		int line = -scroll.y;
+		while (dy > 0) {
+			if (topRow >= dy) {
+				topRow -= dy;
+				break;
+			}
+			dy -= topRow + 1;
+			topRow = wrapRows(--line) - 1;
+		}
+		while (dy < 0) {
+			int below = wrapRows(line) - topRow;
+			if (-dy < below) {
+				topRow -= dy;
+				break;
+			}
+			dy += below;
+			line++;
+			topRow = 0;
+		}
+		scroll.y = -line;
+	}
+
+	void setWrap(bool wrap) {
+		this->wrap	= wrap;
+		topRow		= 0;
+		scroll.x	= 0;
+		offset.x	= 0;
+		redraw();
+	}
+
+	// empties a row of the next cells and marks it for printing
+	void clearRow(int y) {
+		Cell *c = &cells[cols * rows + y * cols];
+		for (int i = 0; i < cols; i++) {
+			c->c		= '\0';
+			c->fColor	= COLOR_BACK_NORMAL;
+			c->bColor	= COLOR_BACK_NORMAL;
+			c->reserved	= 0;
+			c++;
+		}
+		dirty[y] = 1;
+	}
+
+	// prints the lines with changed text or on dirty rows into the next cells, text that isn't lexed yet
+	// is shown as plain code, the rest of the screen keeps the shown cells
+	void layout() {
+		int ox = EDITOR_GUTTER;
+		lockText();
+
+		valid = true;
+		damage.add(syntax.recolored);
+		syntax.recolored.clear();
+		if (cursor != shownCursor) {
+			damage.add(shownCursor, shownCursor);
+			damage.add(cursor, cursor);
+			shownCursor = cursor;
+		}
+		if (searching && rows)
+			dirty[rows - 1] = 1;
+		for (int r = 0; r < rows; r++)
+			if (dirty[r])
+				clearRow(r);
+
+	// only the lines on the screen are printed, the line at the top is at -scroll.y, with soft wrap
+	// its first topRow rows are above the screen and every line takes as many rows as it wraps into
+		int lineFirst	= scroll.y < 0 ? -scroll.y : 0;
+		int lineLast	= rows - scroll.y;
+		int width		= wrapWidth();
+		lines.scanLines(text, lineLast);
+		if (lineFirst > lines.count()) lineFirst = lines.count();
+		if (lineLast > lines.count()) lineLast = lines.count();
+		if (lineLast < lineFirst) lineLast = lineFirst;
+
+		int from	= lineFirst < lines.count() ? lines[lineFirst] : text.length;
+		int to		= lineLast < lines.count() ? lines[lineLast] : text.length;
+
+		Point pos, caret;
+		bool caretFound = false, caretDrawn = false;
+		char num[4];
+		int y = lineFirst + scroll.y;
+
+		for (int line = lineFirst; line < lineLast && y < rows; line++) {
+			int start	= lines[line];
+			int end		= lines.end(line, text.length);
+			int row		= wrap && line == lineFirst ? topRow : 0;
+			int i		= start;
+			int height	= wrap ? wrapRows(line) - row : 1;
+			int bottom	= y + height < rows ? y + height : rows;
+
+		// a line is printed when its text changed or one of its rows is dirty, the others are only passed by
+			bool changed = damage.hits(start, end);
+			for (int r = y; r < bottom && !changed; r++)
+				changed = dirty[r] != 0;
+			if (!changed) {
+				int column;
+				if (row)
+					from = wrapStart(start, end, row, column);
+				if (y + height > rows)
+					to = wrapStart(start, end, row + rows - y, column);
+				y += height;
+				continue;
+			}
+			for (int r = y; r < bottom; r++)
+				if (!dirty[r])
+					clearRow(r);
+
+			pos = Point(scroll.x, y);
+
+		// a wrapped line is printed from the row at the top, a long line scrolled far to the right
+		// from the column checkpoint left of the screen
+			if (row) {
+				int column;
+				i = wrapStart(start, end, row, column);
+				pos.x = column - row * width;
+				from = i;
+			} else
+				if (scroll.x < 0 && end - start > COLUMN_STEP) {
+					int column;
+					i = columns.seek(text, start, end, -scroll.x, column);
+					pos.x += column;
+				}
+
+			if (!row) {
+				snprintf(num, sizeof(num), "%d", line);
+				int len = strlen(num);
+				int x = 3 - len;
+				print(0, x, y, COLOR_OPCODE, COLOR_BACK_NORMAL, num, len);
+			}
+
+		// the lexeme covering the first printed character may start before it, and so may a match
+			ThemeColor color = COLOR_CODE;
+			int lexIndex = syntax.findLexeme(i);
+			int lexEnd = -1;
+			int lexCount = syntax.lexemes.count();
+			TextBuffer::Cache cache = text.cache;
+			if (lexIndex > 0) {
+				Syntax::Lexeme lex = syntax.lexemes[lexIndex - 1];
+				if (lex.offset + lex.length > i) {
+					color	= (ThemeColor)syntax.lexemeClass(text, lexIndex - 1, cache);
+					lexEnd	= lex.offset + lex.length;
+				}
+			}
+
+			int matchIndex	= search.length ? search.find(i - search.length + 1) : search.count();
+			int matchEnd	= -1;
+
+		// printing stops at the right edge, or goes on in the next row when wrapping
+			TextBuffer::Iterator it = text.at(i);
+			for (; i < end; i++, ++it) {
+				if (pos.x >= (wrap ? width : cols - ox)) {
+					if (!wrap)
+						break;
+					pos.x -= width;
+					if (++pos.y >= rows)
+						break;
+				}
+
+				if (i == lexEnd)
+					color = COLOR_CODE;
+
+				while (matchIndex < search.count() && search[matchIndex] <= i)
+					matchEnd = search[matchIndex++] + search.length;
+
+				while (lexIndex < lexCount && i == syntax.lexemes.offset[lexIndex]) {
+					if (int length = syntax.lexemes.length[lexIndex]) {
+						color	= (ThemeColor)syntax.lexemeClass(text, lexIndex, cache);
+						lexEnd	= i + length;
+					}
+					lexIndex++;
+				}
+
+				char c = *it;
+				if (i == cursor) {
+					caret = pos;
+					caretFound = true;
+				// draw the cursor as an inverted cell over printable characters
+					if (c != '\t') {
+						fColor = COLOR_BACK_NORMAL;
+						bColor = COLOR_CURSOR;
+						print(ox, pos.x, pos.y, c);
+						caretDrawn = true;
+						continue;
+					}
+				}
+
+				fColor = color;
+				bColor = i < matchEnd ? COLOR_BACK_SEARCH : COLOR_BACK_NORMAL;
+				print(ox, pos.x, pos.y, c);
+			}
+
+		// the cursor may be on the line break or at the end of the text
+			if (i == end && cursor == end) {
+				caret = pos;
+				caretFound = true;
+			}
+			if (wrap && pos.y >= rows)
+				to = i;
+			y = pos.y + 1;
+		}
+		bColor = COLOR_BACK_NORMAL;
+		lexFrom	= from;
+		lexTo	= to;
+
+	// lines that moved up leave the rows below the end of the text
+		if (damage.to >= text.length)
+			for (y = y > 0 ? y : 0; y < rows; y++)
+				if (!dirty[y])
+					clearRow(y);
+		damage.clear();
+
+		if (caretFound && !caretDrawn)
+			print(ox, caret.x, caret.y, COLOR_CURSOR, COLOR_BACK_NORMAL, "\xDD", 1);
+
+	// the query being typed covers the bottom row
+		if (searching) {
+			char bar[SEARCH_QUERY + 64];
+			int len = snprintf(bar, sizeof(bar), "find: %.*s   %d matches", search.length, search.query, search.count());
+			fColor = COLOR_CODE;
+			bColor = COLOR_BACK_SEARCH;
+			for (int x = 0; x < cols; x++)
+				putChar(x, rows - 1, x < len ? bar[x] : ' ');
+			bColor = COLOR_BACK_NORMAL;
+		}
+
+		unlockText();
+	}
+
+#ifdef XEDIT_PROFILE
+	// the last finished frame over the top right corner, drawn straight into the canvas after the cells,
+	// the cells below are marked so they get drawn again once the numbers are gone or scrolled along
+	void drawProfile(Canvas *canvas) {
+		Profiler::Frame frame;
+		if (!profiler.hud || !canvas->pixels || !profiler.last(frame))
+			return;
+
+		char lines[Profiler::STAGE_MAX + 4][32];
+		int count = 0;
+		snprintf(lines[count++], sizeof(lines[0]), "frame   %8.2f ms", frame.length * 1000.0);
+		for (int s = 0; s < Profiler::STAGE_MAX; s++)
+			snprintf(lines[count++], sizeof(lines[0]), "%-7s %8.2f ms", Profiler::name(s), frame.time[s] * 1000.0);
+		snprintf(lines[count++], sizeof(lines[0]), "cells   %8d", frame.count[Profiler::COUNTER_CELLS]);
+		snprintf(lines[count++], sizeof(lines[0]), "glyphs  %8d", frame.count[Profiler::COUNTER_GLYPHS]);
+		snprintf(lines[count++], sizeof(lines[0]), "bytes   %8d", frame.count[Profiler::COUNTER_BYTES]);
+
+		int width	= 20 < cols ? 20 : cols;
+		int height	= count < rows ? count : rows;
+		int ox		= cols - width;
+		Cell *c = cells;
+		for (int y = 0; y < height; y++) {
+			dirty[y] = 1;
+			int len = (int)strlen(lines[y]);
+			for (int x = 0; x < width; x++) {
+				char ch = x > 0 && x - 1 < len ? lines[y][x - 1] : ' ';
+				font->putChar(canvas->format, ch, theme.code, theme.back_line, canvas->at((ox + x) * 9, y * 16), canvas->stride);
+				c[ox + x + y * cols].reserved = 1;
+			}
+		}
+		canvas->invalidate(Rect(ox * 9, 0, cols * 9, height * 16));
+	}
+#endif
+
+	// whether the next four cells are the same, in one wide compare
+	static bool sameCells(const Cell *a, const Cell *b) {
+	#ifdef XEDIT_SSE2
+		__m128i x = _mm_loadu_si128((const __m128i*)a);
+		__m128i y = _mm_loadu_si128((const __m128i*)b);
+		return _mm_movemask_epi8(_mm_cmpeq_epi32(x, y)) == 0xFFFF;
+	#else
+		return !memcmp(a, b, 4 * sizeof(Cell));
+	#endif
+	}
+
+	// draws the cells of the dirty rows in [from, to) that differ from the shown ones, which they replace
+	template <class F>
+	void rasterize(char *pixels, int stride, int from, int to, GlyphCache *cache) {
+		typedef typename F::Pixel Pixel;
+		Cell *next	= &cells[cols * rows];
+
+		int changed = 0, drawn = 0;
+		for (int r = from; r < to; r++) {
+			int l = cols, h = -1;
+			int width = dirty[r] ? cols : 0;
+			dirty[r] = 0;
+
+			for (int c = 0; c < width; c++) {
+				Cell &cell = next[c + r * cols];
+				Cell &last = cells[c + r * cols];
+
+			// most of a printed row is usually the same as before
+				if (!(c & 3) && c + 4 <= width && sameCells(&cell, &last)) {
+					c += 3;
+					continue;
+				}
+
+				if (cell.id != last.id) {
+					Pixel *pixel = (Pixel*)&pixels[c * 9 * sizeof(Pixel) + r * 16 * stride];
+					changed++;
+					if (cell.c != '\0') {
+						drawGlyph<F>(cache, cell.c, (ThemeColor)(unsigned char)cell.fColor, (ThemeColor)(unsigned char)cell.bColor, pixel, stride);
+						drawn++;
+					} else {
+						Pixel b = F::pack(theme.byID[(unsigned char)cell.bColor]);
+						for (int y = 0; y < 16; y++, pixel = advance(pixel, stride))
+							for (int x = 0; x < 9; x++)
+								pixel[x] = b;
+					}
+
+					last = cell;
+					if (l > c) l = c;
+					h = c;
+				}
+			}
+
+			spans[r * 2]		= l;
+			spans[r * 2 + 1]	= h;
+		}
+		PROFILE_COUNT(COUNTER_CELLS, changed);
+		PROFILE_COUNT(COUNTER_GLYPHS, drawn);
+	}
+
+	struct Band {
+		Editor	*editor;
+		char	*pixels;
+		int		stride;
+	};
+
+	template <class F>
+	static void rasterizeBand(void *data, int index) {
+		Band *band = (Band*)data;
+		Editor *e = band->editor;
+		e->rasterize<F>(band->pixels, band->stride, e->rows * index / e->bands, e->rows * (index + 1) / e->bands, e->glyphs[index]);
+	}
+
+	// the bands write disjoint rows of pixels and spans, the threads are joined before returning
+	void rasterize(char *pixels, int stride, PixelFormat format) {
+		static void (*const kernels[FORMAT_MAX])(void*, int) = {
+			rasterizeBand<Format32>, rasterizeBand<Format24>, rasterizeBand<Format16>, rasterizeBand<Format15>
+		};
+		if (format != tileFormat) {
+			for (int i = 0; i < bands; i++)
+				glyphs[i]->clear();
+			tileFormat = format;
+		}
+		Band band = { this, pixels, stride };
+		workers->run(kernels[format], &band);
+	}
+
+	void rasterize(Canvas *canvas) {
+		rasterize(canvas->pixels, canvas->stride, canvas->format);
+
+		for (int r = 0; r < rows; r++)
+			if (spans[r * 2 + 1] != -1)
+				canvas->invalidate(Rect(spans[r * 2] * 9, r * 16, (spans[r * 2 + 1] + 1) * 9, (r + 1) * 16));
+	}
+};
+
+static const Editor::Theme THEME_DARK = {
+	0xDADADA, // code
+	0xD69D85, // text
+	0x4EC9B0, // type
+	0xBD63C5, // define
+	0xB5CEA8, // number
+	0x569CD6, // opcode
+	0x57A64A, // comment
+	0x7F7F7F, // argument
+	0x000000, // back_line
+	0x1E1E1E, // back_normal
+	0x264F78, // back_selection
+	0x653306, // back_search
+	0xDCDCDC, // cursor
+};
+
+#define FRAME_RATE	60	// frames per second at most, 0 draws as soon as the pending events are handled
+
+struct Application {
+	int		width, height;
+	Canvas	*canvas;
+	Editor	*editor;
+
+#ifdef WIN32
+	HWND	handle;
+	HDC		dc;
+
+	static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+		Application *app = (Application*)GetWindowLong(hWnd, GWL_USERDATA);
+
+		switch (msg) {
+			case WM_PAINT : {
+					RECT r;
+					if (GetUpdateRect(hWnd, &r, FALSE))
+						app->canvas->invalidate(Rect(r.left, r.top, r.right, r.bottom));
+					app->paint();
+					ValidateRect(hWnd, NULL);
+				}
+				break;
+			case WM_SIZE :
+				app->resize(LOWORD(lParam), HIWORD(lParam));
+				break;
+			case WM_KEYDOWN :
+				app->editor->onKey(wParam);
+				app->paint();
+				break;
+			case WM_CHAR :
+				app->editor->onChar(wParam);
+				app->paint();
+				break;
+			case WM_MOUSEWHEEL :
+				if (GET_KEYSTATE_WPARAM(wParam) & MK_SHIFT)
+					app->editor->onScroll(GET_WHEEL_DELTA_WPARAM(wParam) / 120 * SCROLL_COLUMNS, 0);
+				else
+					app->editor->onScroll(0, GET_WHEEL_DELTA_WPARAM(wParam) / 120);
+				app->paint();
+				break;
+			case WM_USER :
+				app->editor->invalidate(Rect(0, 0, app->width, app->height));
+				app->paint();
+				break;
+			case WM_LBUTTONDOWN : 
+			case WM_RBUTTONDOWN : {
+					int x = GET_X_LPARAM(lParam);
+					int y = GET_Y_LPARAM(lParam);
+				}
+				break;
+			case WM_DESTROY :
+				app->close();
+				break;
+			default :
+				return DefWindowProc(hWnd, msg, wParam, lParam);
+		}
+		return 0;
+	}
+#endif
 
-		valid = false;
+#ifdef __linux__
+	Display	*display;
+	Window	window;
+	Atom	WM_DELETE_WINDOW;
+	bool	dirty;		// a frame is due, painted once the queued events are handled
+	double	interval;	// shortest time between two frames
+	double	frameTime;	// start of the last frame
+	int		wakeup[2];	// pipe the lexer thread writes to when the screen needs new colors
+#endif
+
+	// on the lexer thread, the window thread gets a message to repaint
+	static void lexed(void *data) {
+		Application *app = (Application*)data;
+	#ifdef WIN32
+		PostMessage(app->handle, WM_USER, 0, 0);
+	#endif
+	#ifdef __linux__
+		char c = 0;
+		if (write(app->wakeup[1], &c, 1)) {}
+	#endif
+	}
+
+	Application(int width, int height, const char *name) : width(width), height(height) {
+	#ifdef WIN32
+		canvas = new Canvas();
+		editor = new Editor(THEME_DARK);
+		editor->onLexed		= lexed;
+		editor->onLexedData	= this;
+		if (!editor->open(name))
+			printf("can't open %s\n", name);
+
+		handle = CreateWindow("static", "xedit", WS_OVERLAPPEDWINDOW, 0, 0, width, height, NULL, NULL, NULL, NULL);
+		dc = GetDC(handle);
+		SetWindowLong(handle, GWL_USERDATA, (LONG)this);
+		SetWindowLong(handle, GWL_WNDPROC, (LONG)&WndProc);
+		ShowWindow(handle, SW_SHOWDEFAULT);
+	#endif
+	
+	#ifdef __linux__
+		display = XOpenDisplay(NULL);
+		if (!display) {
+			printf("can't connect to X server\n");
+			return;
+		}		
+		Window root = DefaultRootWindow(display);
+		int screen = DefaultScreen(display);
+		
+		XSetWindowAttributes attr;
+		attr.event_mask = ExposureMask | PointerMotionMask | ButtonPressMask | KeyPressMask | StructureNotifyMask | FocusChangeMask;		
+
+		window = XCreateWindow(display, root, 0, 0, width, height, 0, 0, InputOutput, NULL, CWEventMask, &attr);
+					
+		XMapWindow(display, window);
+		XSync(display, false);
+		
+		XStoreName(display, window, "xedit");
+		WM_DELETE_WINDOW = XInternAtom(display, "WM_DELETE_WINDOW", false);
+		XSetWMProtocols(display, window, &WM_DELETE_WINDOW, 1);
+		
+		canvas = new Canvas(display);
+		editor = new Editor(THEME_DARK);
+		if (pipe(wakeup) == 0) {
+			fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+			fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+			editor->onLexed		= lexed;
+			editor->onLexedData	= this;
+		} else
+			wakeup[0] = wakeup[1] = -1;
+		if (!editor->open(name))
+			printf("can't open %s\n", name);
+		resize(800, 600);
+
+		dirty		= true;
+		frameTime	= 0.0;
+		setFrameRate(FRAME_RATE);
+	#endif
+	}
+
+	~Application() {
+		delete editor;
+		delete canvas;
+	#ifdef WIN32
+		ReleaseDC(handle, dc);
+		DestroyWindow(handle);
+	#endif
+	
+	#ifdef __linux__
+		if (wakeup[0] != -1) {
+			::close(wakeup[0]);
+			::close(wakeup[1]);
+		}
+		XDestroyWindow(display, window);
+		XCloseDisplay(display);
+	#endif
+	}
+
+	void close() {
+	#ifdef WIN32
+		PostQuitMessage(0);
+	#endif
+	}
+
+	void invalidate() {
+	#ifdef WIN32
+		InvalidateRect(handle, NULL, false);
+	#endif
+	
+	#ifdef __linux__
+	// repainted by the loop, no Expose round trip through the server
+		canvas->invalidate();
+		dirty = true;
+	#endif	
+	}
+
+#ifdef __linux__
+	void setFrameRate(int fps) {
+		interval = fps > 0 ? 1.0 / fps : 0.0;
+	}
+
+	// sleeps until the connection or the lexer thread has something or the timeout in seconds runs out,
+	// a negative timeout waits forever
+	void wait(double timeout) {
+		int fd = ConnectionNumber(display);
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		if (wakeup[0] != -1)
+			FD_SET(wakeup[0], &fds);
+
+		timeval t;
+		t.tv_sec	= (int)timeout;
+		t.tv_usec	= (int)((timeout - t.tv_sec) * 1000000);
+		int max = fd > wakeup[0] ? fd : wakeup[0];
+		if (select(max + 1, &fds, NULL, NULL, timeout < 0.0 ? NULL : &t) > 0 && wakeup[0] != -1 && FD_ISSET(wakeup[0], &fds)) {
+			char buf[64];
+			while (read(wakeup[0], buf, sizeof(buf)) > 0) {}
+			editor->invalidate(Rect(0, 0, width, height));
+			dirty = true;
+		}
+	}
+
+	// applies one event to the editor, returns false when the window is closed
+	bool handle(XEvent &e) {
+		if (e.type == canvas->completion) {
+			canvas->complete(e);
+			return true;
+		}
+
+		switch (e.type) {
+			case FocusIn:
+				invalidate();
+				break;
+			case ButtonPress :
+			// the wheel scrolls sideways with shift held
+				if (e.xbutton.state & ShiftMask) {
+					if (e.xbutton.button == 4)	editor->onScroll(+SCROLL_COLUMNS, 0);
+					if (e.xbutton.button == 5)	editor->onScroll(-SCROLL_COLUMNS, 0);
+				} else {
+					if (e.xbutton.button == 4)	editor->onScroll(0, +1);
+					if (e.xbutton.button == 5)	editor->onScroll(0, -1);
+				}
+				if (e.xbutton.button == 6)	editor->onScroll(+SCROLL_COLUMNS, 0);
+				if (e.xbutton.button == 7)	editor->onScroll(-SCROLL_COLUMNS, 0);
+				dirty = true;
+				break;				
+			case MotionNotify :
+			//	printf("mouse: %d %d\n", e.xmotion.x, e.xmotion.y);
+			//	offset = e.xmotion.y;
+			//	draw(display, window, DefaultGC(display, screen));
+				break;
+			case KeyPress: {
+				//	printf("key: %d %d\n", e.xkey.state, e.xkey.keycode);
+					char c;
+					if (e.xkey.keycode != VK_BACK &&
+						XLookupString(&e.xkey, &c, 1, NULL, NULL)) {
+						editor->onChar(c);
+					//	printf("char %d %d\n", len, (int));
+					} else
+						editor->onKey(e.xkey.keycode);
+					dirty = true;
+				}
+				break;
+			case ConfigureNotify : {
+					width	= e.xconfigure.width;
+					height	= e.xconfigure.height;
+					resize(width, height);
+					dirty = true;
+				}
+				break;
+			case Expose :
+				canvas->invalidate(Rect(e.xexpose.x, e.xexpose.y, e.xexpose.x + e.xexpose.width, e.xexpose.y + e.xexpose.height));
+				dirty = true;
+				break;
+			case GraphicsExpose :
+				canvas->invalidate(Rect(e.xgraphicsexpose.x, e.xgraphicsexpose.y, e.xgraphicsexpose.x + e.xgraphicsexpose.width, e.xgraphicsexpose.y + e.xgraphicsexpose.height));
+				dirty = true;
+				break;
+			case ClientMessage :
+				if ((Atom)e.xclient.data.l[0] == WM_DELETE_WINDOW)
+					return false;
+				break;					
+		}
+		return true;
+	}
+#endif
+
+	void resize(int width, int height) {
+		editor->resize(width, height);
+		canvas->resize(editor->cols * 9, editor->rows * 16);
+	}
+
+	void loop() {
+	#ifdef WIN32
+		MSG msg;
+		while (GetMessage(&msg, 0, 0, 0)) {
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);			
+		}
+	#endif
+	
+	#ifdef __linux__
+		XEvent e;
+		bool quit = false;
+		while (!quit) {
+		// everything queued is applied first, key repeat and wheel bursts end up in a single frame
+			while (!quit && XPending(display)) {
+				XNextEvent(display, &e);
+				LATENCY_ARRIVE(e);
+				quit = !handle(e);
+				LATENCY_HANDLE(e);
+			}
+			if (quit)
+				break;
+
+			if (!dirty) {
+				wait(-1.0);
+				continue;
+			}
+
+			double delay = frameTime + interval - getTime();
+			if (delay > 0.0) {
+				wait(delay);
+				continue;
+			}
+
+			frameTime = getTime();
+			dirty = false;
+			paint();
+			LATENCY_PRESENT(display);
+		}	
+	#endif
+	}
+
+	void paint() {
+		PROFILE_BEGIN_FRAME();
+		editor->render(canvas);
+		{
+			PROFILE_SCOPE(STAGE_PRESENT);
+		#ifdef WIN32
+			canvas->present(dc);
+		#endif
+		#ifdef __linux__
+			canvas->present(window);
+		#endif
+		}
+		PROFILE_COUNT(COUNTER_BYTES, canvas->uploaded);
+		PROFILE_END_FRAME();
+	}
+};
+
+#if defined(XEDIT_BENCH) || defined(XEDIT_LATENCY)
+// one result per line on stdout: name value unit, diagnostics go to stderr
+void report(const char *name, double value, const char *unit) {
+	printf("%-32s %12.2f %s\n", name, value, unit);
+}
+
+void report(const char *prefix, const char *name, double value, const char *unit) {
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%s.%s", prefix, name);
+	report(buf, value, unit);
+}
+
+// C-like source with every lexeme class in it, about size bytes long
+char* synthesize(int size, int &length) {
+	char *data = (char*)malloc(size + 1024);
+	length = 0;
+	for (int i = 0; length < size; i++)
+		length += sprintf(&data[length],
+			"/* block comment %d\n"
+			"   spanning two lines */\n"
+			"static int func%d(const char *str, float x) {\n"
+			"\t// line comment with \"quotes\" and 'c'\n"
+			"\tint value = %d + 0x%X;\n"
+			"\tif (str[0] == '\\'' || x > 1.5f)\n"
+			"\t\treturn sizeof(Rect) * value;\n"
+			"\tprintf(\"text %%d\\n\", value);\n"
+			"#define MACRO_%d (value << 2)\n"
+			"\treturn value;\n"
+			"}\n\n", i, i, i * 7, i, i);
+	return data;
+}
+#endif
+
+#ifdef XEDIT_BENCH
+// draws a full 1920x1080 screen of glyphs until the time runs out, returns glyphs per second
+template <class F>
+double benchGlyphs(BitFont *font, void (BitFont::*blit)(unsigned char, Color, Color, typename F::Pixel*, int), Color bColor) {
+	typedef typename F::Pixel Pixel;
+	int cols = 1920 / 9, rows = 1080 / 16, width = cols * 9;
+	Pixel *pixels = new Pixel[width * rows * 16];
+	int count = 0;
+
+	double start = getTime(), time;
+	do {
+		for (int r = 0; r < rows; r++)
+			for (int c = 0; c < cols; c++)
+				(font->*blit)((unsigned char)(count + c + r), 0xDADADA, bColor, &pixels[c * 9 + r * 16 * width], width * sizeof(Pixel));
+		count += cols * rows;
+		time = getTime() - start;
+	} while (time < 0.5);
+
+	delete[] pixels;
+	return count / time;
+}
+
+// same screen through the tile cache, 96 printable characters in 8 color pairs
+template <class F>
+double benchGlyphCache(BitFont *font, GlyphCache *cache) {
+	typedef typename F::Pixel Pixel;
+	int cols = 1920 / 9, rows = 1080 / 16, width = cols * 9;
+	Pixel *pixels = new Pixel[width * rows * 16];
+	int count = 0;
+
+	double start = getTime(), time;
+	do {
+		for (int r = 0; r < rows; r++)
+			for (int c = 0; c < cols; c++) {
+				int n = count + c + r;
+				unsigned char ch = ' ' + n % 96;
+				int color = (n / 96) % 8;
+				bool fresh;
+				Pixel *tile = (Pixel*)cache->get(ch | color << 8 | 9 << 16, fresh);
+				if (fresh)
+					font->putChar<F>(ch, 0x404040 * color, 0x1E1E1E, tile, 9 * sizeof(Pixel));
+				GlyphCache::draw(tile, &pixels[c * 9 + r * 16 * width], width * sizeof(Pixel));
+			}
+		count += cols * rows;
+		time = getTime() - start;
+	} while (time < 0.5);
+
+	delete[] pixels;
+	return count / time;
+}
+
+// full redraws of a 1920x1080 screen of this file, returns frames per second of rasterization alone
+double benchRaster(Editor *editor, int threads, PixelFormat format) {
+	editor->setThreads(threads);
+	editor->resize(1920, 1080);
+	int stride = editor->cols * 9 * pixelSize(format);
+	char *pixels = new char[stride * editor->rows * 16];
+	int count = 0;
+
+	double time = 0.0;
+	do {
+		editor->redraw();
+		editor->layout();
+		double start = getTime();
+		editor->rasterize(pixels, stride, format);
+		time += getTime() - start;
+		count++;
+	} while (time < 0.5);
+
+	delete[] pixels;
+	return count / time;
+}
+
+// the glyph kernels, the tile cache and single threaded redraws of this file, drawing pixels of one format
+template <class F>
+void benchFormat(BitFont *font, Editor *editor, PixelFormat format, bool vector) {
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), "glyph.%s", formatName(format));
+	report(prefix, "scalar.opaque",			benchGlyphs<F>(font, &BitFont::putCharScalar<F>, 0x1E1E1E) * 0.000001, "Mglyph/s");
+	report(prefix, "scalar.transparent",	benchGlyphs<F>(font, &BitFont::putCharScalar<F>, COLOR_CLEAR) * 0.000001, "Mglyph/s");
+#ifdef XEDIT_SSE2
+	if (vector) {
+		report(prefix, "sse2.opaque",		benchGlyphs<F>(font, &BitFont::putChar<F>, 0x1E1E1E) * 0.000001, "Mglyph/s");
+		report(prefix, "sse2.transparent",	benchGlyphs<F>(font, &BitFont::putChar<F>, COLOR_CLEAR) * 0.000001, "Mglyph/s");
+	}
+#endif
+	GlyphCache cache(GLYPH_CACHE_BUDGET);
+	report(prefix, "cache",				benchGlyphCache<F>(font, &cache) * 0.000001, "Mglyph/s");
+	report(prefix, "cache.hit",			100.0 * cache.hits / (cache.hits + cache.misses), "%");
+	report(prefix, "cache.evictions",	cache.evictions, "tiles");
+
+	snprintf(prefix, sizeof(prefix), "raster.%s", formatName(format));
+	report(prefix, "threads.1", benchRaster(editor, 1, format), "frame/s");
+}
+
+// searches contiguous text with one kernel until the time runs out, returns bytes per second
+template <typename Kernel>
+double benchScan(const Search &search, Kernel kernel, const char *data, int length) {
+	GapArray<int> found;
+	int count = 0;
+	double start = getTime(), time;
+	do {
+		found.clear();
+		(search.*kernel)(data, length, 0, found);
+		count++;
+		time = getTime() - start;
+	} while (time < 0.5);
+	return (double)length * count / time;
+}
+
+// whole text searches split among the threads of the pool, returns bytes per second
+double benchScanAll(Search &search, const TextBuffer &text, WorkerPool *pool) {
+	int count = 0;
+	double start = getTime(), time;
+	do {
+		search.scanAll(text, pool);
+		count++;
+		time = getTime() - start;
+	} while (time < 0.5);
+	return (double)text.length * count / time;
+}
+
+// a common word, a rare one and a miss in a big synthetic text, by kernel and by thread count
+void benchSearch(int size) {
+	int length;
+	char *data = synthesize(size, length);
+	TextBuffer text;
+	text.load(data, length);
+
+	const char *names[]		= { "common", "rare", "none" };
+	const char *queries[]	= { "value", "MACRO_4242 ", "xyzzy" };
+	int cores = std::thread::hardware_concurrency();
+	for (int q = 0; q < 3; q++) {
+		char prefix[64];
+		snprintf(prefix, sizeof(prefix), "search.%s", names[q]);
+		Search search;
+		search.set(text, queries[q], strlen(queries[q]), NULL);
+		report(prefix, "matches",	search.count(), "");
+		report(prefix, "scalar",	benchScan(search, &Search::scanBlockScalar, data, length) / 1024.0 / 1024.0 / 1024.0, "GB/s");
+	#ifdef XEDIT_SSE2
+		report(prefix, "sse2",		benchScan(search, &Search::scanBlockSSE2, data, length) / 1024.0 / 1024.0 / 1024.0, "GB/s");
+	#endif
+		for (int threads = 1; threads <= (cores > 2 ? cores : 2); threads *= 2) {
+			WorkerPool pool(threads - 1);
+			char name[64];
+			snprintf(name, sizeof(name), "threads.%d", threads);
+			report(prefix, name, benchScanAll(search, text, &pool) / 1024.0 / 1024.0 / 1024.0, "GB/s");
+		}
+	}
+}
+
+// offset of the start of a line, or the length if there are fewer lines
+int lineStart(const char *data, int length, int line) {
+	int pos = 0;
+	while (line && pos < length)
+		if (LineIndex::isLineBreak(data[pos++]))
+			line--;
+	return pos;
+}
+
+// frame times split into stages, summed over all frames
+struct Stages {
+	double	scroll, layout, raster, upload;
+	int		frames;
+
+	Stages() : scroll(0.0), layout(0.0), raster(0.0), upload(0.0), frames(0) {}
+
+	void frame(Editor *editor, Canvas *canvas) {
+		double t0 = getTime();
+		editor->applyScroll(canvas);
+		double t1 = getTime();
+		editor->layout();
+		double t2 = getTime();
+		editor->rasterize(canvas);
+		double t3 = getTime();
+		canvas->present();
+
+		scroll	+= t1 - t0;
+		layout	+= t2 - t1;
+		raster	+= t3 - t2;
+		upload	+= canvas->uploaded;
+		frames++;
+	}
+
+	void report(const char *prefix, const char *name) {
+		char buf[256];
+		snprintf(buf, sizeof(buf), "%s.%s", prefix, name);
+		::report(buf, "scroll",		scroll * 1000000.0 / frames, "us");
+		::report(buf, "layout",		layout * 1000000.0 / frames, "us");
+		::report(buf, "rasterize",	raster * 1000000.0 / frames, "us");
+		::report(buf, "frame",		(scroll + layout + raster) * 1000000.0 / frames, "us");
+		::report(buf, "upload",		upload / 1024.0 / frames, "KB");
+	}
+};
+
+#ifdef __linux__
+// frames per second a 1920x1080 window takes, whole frames and a single changed row, through shared images
+// and through XPutImage, needs an X server such as Xvfb
+void benchPresent() {
+	Display *display = XOpenDisplay(NULL);
+	if (!display) {
+		fprintf(stderr, "can't connect to X server, present isn't measured\n");
+		return;
+	}
+	int width = 1920, height = 1080;
+	Window window = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, width, height, 0, 0, 0);
+	XMapWindow(display, window);
+	XSync(display, false);
+
+	for (int shared = 1; shared >= 0; shared--) {
+		Canvas *canvas = new Canvas(display);
+		canvas->resize(width, height);
+		canvas->setShared(shared != 0);
+		if (canvas->shm != (shared != 0)) {
+			delete canvas;
+			continue;
+		}
+
+		for (int full = 1; full >= 0; full--) {
+			int count = 0;
+			double bytes = 0.0, time, start = getTime();
+			do {
+				Color color = 0x010101 * (count & 0xFF);
+				int y = full ? 0 : 16 * (count % (height / 16));
+				canvas->fill(0, y, width, full ? height : 16, color);
+				canvas->invalidate(Rect(0, y, width, y + (full ? height : 16)));
+				canvas->present(window);
+				bytes += canvas->uploaded;
+				count++;
+				time = getTime() - start;
+			} while (time < 1.0);
+
+		// the frames still in flight count too
+			XSync(display, false);
+			time = getTime() - start;
+
+			char name[64];
+			snprintf(name, sizeof(name), "present.%s.%s", shared ? "shm" : "put", full ? "full" : "row");
+			report(name, "rate", count / time, "frame/s");
+			report(name, "speed", bytes / time / 1024.0 / 1024.0, "MB/s");
+		}
+		delete canvas;
+	}
+
+	XDestroyWindow(display, window);
+	XCloseDisplay(display);
+}
+#endif
+
+// lexing, cold render, full redraws, a scroll sweep and edits of one file on a headless 1920x1080 canvas
+void benchFile(const char *name, const char *data, int length, const Editor::Syntax::Language *language) {
+	char *copy = (char*)malloc(length);
+	memcpy(copy, data, length);
+	TextBuffer text;
+	text.load(copy, length);
+	Editor::Syntax syntax;
+	syntax.language = language;
+	double start = getTime();
+	syntax.parse(text);
+	double time = getTime() - start;
+	report(name, "size",		length / 1024.0, "KB");
+	report(name, "lex",			time * 1000.0, "ms");
+	report(name, "lex.speed",	length / time / 1024.0 / 1024.0, "MB/s");
+	report(name, "lexemes",		syntax.lexemes.count(), "");
+
+// where every defined name is, as a jump to its definition finds it
+	Editor::Syntax::Symbols &symbols = syntax.symbols;
+	report(name, "symbols", symbols.count(), "");
+	if (symbols.names.count) {
+		int found = 0;
+		start = getTime();
+		for (int i = 0; i < symbols.names.count; i++)
+			found += symbols.locate(symbols.names.items[i].str, symbols.names.items[i].length) != -1;
+		report(name, "symbols.locate", (getTime() - start) * 1000000000.0 / symbols.names.count, "ns");
+		if (found != symbols.names.count)
+			fprintf(stderr, "%s: %d of %d names without a definition\n", name, symbols.names.count - found, symbols.names.count);
+	}
+
+	// the same parse split among threads, the first one being the caller
+	int cores = std::thread::hardware_concurrency();
+	for (int threads = 1; threads <= (cores > 2 ? cores : 2); threads *= 2) {
+		WorkerPool pool(threads - 1);
+		Editor::Syntax split;
+		split.language = language;
+		start = getTime();
+		split.parse(text, &pool);
+		time = getTime() - start;
+		char buf[64];
+		snprintf(buf, sizeof(buf), "lex.threads.%d", threads);
+		report(name, buf, length / time / 1024.0 / 1024.0, "MB/s");
+		if (split.lexemes.count() != syntax.lexemes.count())
+			fprintf(stderr, "%s: %d lexemes from %d threads\n", name, split.lexemes.count(), threads);
+	}
+
+	Editor *editor = new Editor(THEME_DARK);
+	Canvas *canvas = new Canvas();
+	editor->resize(1920, 1080);
+	canvas->resize(editor->cols * 9, editor->rows * 16);
+
+	copy = (char*)malloc(length);
+	memcpy(copy, data, length);
+	editor->syntax.language = language;
+	start = getTime();
+	editor->load(copy, length);
+	report(name, "open", (getTime() - start) * 1000.0, "ms");
+
+	start = getTime();
+	editor->render(canvas);
+	canvas->present();
+	report(name, "render.cold", (getTime() - start) * 1000.0, "ms");
+	editor->waitLexed();
+	report(name, "highlight", (getTime() - start) * 1000.0, "ms");
+
+	Stages redraw;
+	for (int i = 0; i < 100; i++) {
+		editor->redraw();
+		redraw.frame(editor, canvas);
+	}
+	redraw.report(name, "redraw");
+
+	Stages scroll;
+	for (int i = 0; i < 1000; i++) {
+		editor->onScroll(0, -1);
+		scroll.frame(editor, canvas);
+	}
+	scroll.report(name, "scroll");
+
+	Stages page;
+	for (int i = 0; i < 100; i++) {
+		editor->onScroll(0, i < 50 ? -editor->rows : editor->rows);
+		page.frame(editor, canvas);
+	}
+	page.report(name, "page");
+
+// a character typed and erased again at the start of the lines on the screen
+	Stages edit;
+	double update = 0.0;
+	for (int i = 0; i < 200; i++) {
+		editor->setCursor(lineStart(data, length, 1000 + i % 40));
+		start = getTime();
+		editor->onChar('x');
+		update += getTime() - start;
+		edit.frame(editor, canvas);
+
+		start = getTime();
+		editor->onKey(VK_BACK);
+		update += getTime() - start;
+		edit.frame(editor, canvas);
+	}
+	report(name, "edit.update", update * 1000000.0 / edit.frames, "us");
+	edit.report(name, "edit");
+
+// an opened block comment changes the lexemes down to the next comment end
+	editor->setCursor(lineStart(data, length, 1000));
+	start = getTime();
+	editor->onChar('/');
+	editor->onChar('*');
+	report(name, "edit.comment.open", (getTime() - start) * 1000.0, "ms");
+	start = getTime();
+	editor->onKey(VK_BACK);
+	editor->onKey(VK_BACK);
+	report(name, "edit.comment.close", (getTime() - start) * 1000.0, "ms");
+
+	delete canvas;
+	delete editor;
+}
+
+#ifdef __linux__
+// writes the file back and drops it from the page cache, so the next open has to read from the disk
+void dropCache(const char *name) {
+	int fd = open(name, O_RDONLY);
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+// bytes of the file in the page cache
+double residentSize(const char *name) {
+	int fd = open(name, O_RDONLY);
+	struct stat st;
+	fstat(fd, &st);
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	int page = sysconf(_SC_PAGESIZE);
+	int count = (st.st_size + page - 1) / page;
+	unsigned char *pages = new unsigned char[count];
+	mincore(data, st.st_size, pages);
+	double size = 0.0;
+	for (int i = 0; i < count; i++)
+		size += pages[i] & 1;
+	delete[] pages;
+	munmap(data, st.st_size);
+	return size * page;
+}
+#endif
+
+// frames of a single 10 MB line with tabs scrolled to column 5,000,000, the first one builds the column index up to there
+void benchLongLine() {
+	int length = 10 * 1024 * 1024;
+	char *data = (char*)malloc(length);
+	for (int i = 0; i < length; i++)
+		data[i] = i % 37 == 0 ? '\t' : 'a' + i % 26;
+
+	Editor *editor = new Editor(THEME_DARK);
+	Canvas *canvas = new Canvas();
+	editor->resize(1920, 1080);
+	canvas->resize(editor->cols * 9, editor->rows * 16);
+	editor->load(data, length);
+	editor->render(canvas);
+	editor->waitLexed();
+
+	editor->onScroll(-5000000, 0);
+	double start = getTime();
+	editor->render(canvas);
+	report("longline.first", (getTime() - start) * 1000.0, "ms");
+
+	int frames = 100;
+	start = getTime();
+	for (int i = 0; i < frames; i++) {
+		editor->onScroll(i & 1 ? 7 : -7, 0);
+		editor->render(canvas);
+		canvas->present();
+	}
+	report("longline.frame", (getTime() - start) * 1000.0 / frames, "ms");
+
+	delete canvas;
+	delete editor;
+}
+
+// a sample of each built in language repeated to 8 MB and lexed with its own tables
+void benchLanguages() {
+	const char *names[] = { "shell", "json", "yaml", "text" };
+	const char *samples[] = {
+		"# install the build \"output\"\n"
+		"for f in $FILES; do\n"
+		"\tif [ -f \"$f\" ]; then cp '$f' /usr/local/bin; fi\n"
+		"done\n"
+		"export PATH=\"$HOME/bin:$PATH\" # for ${USER}\n",
+
+		"{ \"name\": \"xedit\", \"version\": 1.25, \"tags\": [\"editor\", \"x11\"],\n"
+		"  \"options\": { \"wrap\": true, \"threads\": 4, \"theme\": null,\n"
+		"    \"path\": \"C:\\\\bin\\\\xedit\" } },\n",
+
+		"# settings for the \"build\"\n"
+		"build:\n"
+		"  - name: 'compile'\n"
+		"    flags: [-O2, -msse2]   # optimized\n"
+		"    threads: 4\n"
+		"    enabled: true\n",
+
+		"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor\n"
+		"incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis\n"
+		"nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.\n",
 	};
+	int size = 8 * 1024 * 1024;
+	for (int l = 0; l < 4; l++) {
+		int sample = strlen(samples[l]);
+		char *data = (char*)malloc(size + sample);
+		int length = 0;
+		while (length < size) {
+			memcpy(&data[length], samples[l], sample);
+			length += sample;
+		}
+		TextBuffer text;
+		text.load(data, length);
+		Editor::Syntax syntax;
+		syntax.language = Editor::Syntax::Language::named(names[l]);
+		double start = getTime();
+		syntax.parse(text);
+		double time = getTime() - start;
 
-	void onScroll(int x, int y) {
-		offset.x += x;
-		offset.y += y;
-		valid = false;
+		char prefix[64];
+		snprintf(prefix, sizeof(prefix), "lex.%s", names[l]);
+		report(prefix, "speed",		length / time / 1024.0 / 1024.0, "MB/s");
+		report(prefix, "lexemes",	syntax.lexemes.count(), "");
 	}
+}
 
-	void resize(int width, int height) {
-		int c = (width + 8) / 9;
-		int r = (height + 15) / 16;
+// time from opening a file to the first frame, once mapped and once read into memory
+void benchStartup(const char *name, int size) {
+	char label[64];
+	snprintf(label, sizeof(label), "startup.%dMB", size / (1024 * 1024));
 
-		if (cols * rows != c * r) {
-			cells = (Cell*)realloc(cells, 2 * c * r * sizeof(cells[0]));
-			for (int i = 0; i < 2 * c * r; i++) {
-				cells[i].c			= '\0';
-				cells[i].bColor		= COLOR_BACK_NORMAL;
-				cells[i].bColor		= COLOR_BACK_NORMAL;
-				cells[i].reserved	= 1;
-			}
-			valid = false;
-		}
-		cols = c;
-		rows = r;
-	};
+	int length;
+	char *data = synthesize(size, length);
+	FILE *f = fopen(name, "wb");
+	fwrite(data, 1, length, f);
+	fclose(f);
+	free(data);
 
-	void putChar(int x, int y, unsigned char c) {
-		if (x < 0 || y < 0 || x >= cols || y >= rows)
-			return;
+	Editor *editor = new Editor(THEME_DARK);
+	Canvas *canvas = new Canvas();
+	editor->resize(1920, 1080);
+	canvas->resize(editor->cols * 9, editor->rows * 16);
 
-		Cell &cell = cells[x + y * cols + (curBuffer ? cols * rows : 0)];
+#ifdef __linux__
+	dropCache(name);
+#endif
+	double start = getTime();
+	editor->open(name);
+	editor->render(canvas);
+	canvas->present();
+	report(label, "mmap", (getTime() - start) * 1000.0, "ms");
+	editor->waitLexed();
+	report(label, "mmap.highlight", (getTime() - start) * 1000.0, "ms");
+#ifdef __linux__
+	report(label, "mmap.resident", residentSize(name) / 1024.0, "KB");
+	dropCache(name);
+#endif
 
-		if (cell.c == c && cell.fColor == fColor && cell.bColor == bColor)
-			return;
+	start = getTime();
+	f = fopen(name, "rb");
+	data = (char*)malloc(length);
+	fread(data, 1, length, f);
+	fclose(f);
+	editor->load(data, length);
+	editor->render(canvas);
+	canvas->present();
+	report(label, "read", (getTime() - start) * 1000.0, "ms");
 
-		cell.c		= c;
-		cell.fColor	= fColor;
-		cell.bColor	= bColor;
-	};
+	delete canvas;
+	delete editor;
+	remove(name);
+}
 
-	void print(int ox, int &x, int &y, ThemeColor fColor, ThemeColor bColor, const char *text, int length) {
-		if (!length) return;
+int main(int argc, char **argv) {
+	BitFont *font = new BitFont("font.dat");
+	Editor *editor = new Editor(THEME_DARK);
+	editor->open("main.cpp");
 
-		this->fColor = fColor;
-		this->bColor = bColor;
+	benchFormat<Format32>(font, editor, FORMAT_32, true);
+	benchFormat<Format24>(font, editor, FORMAT_24, false);
+	benchFormat<Format16>(font, editor, FORMAT_16, true);
+	benchFormat<Format15>(font, editor, FORMAT_15, true);
 
-		for (int i = 0; i < length; i++)
-			switch (text[i]) {
-				case '\n' :
-				//	break;
-				case '\r' :
-					x = 0;
-					y++;
-					break;
-				case '\t' :
-					x = (x / 4 + 1) * 4;
-					break;
-				default :
-					putChar(ox + x, y, text[i]);
-					x++;
-			}
+	int cores = std::thread::hardware_concurrency();
+	double single = benchRaster(editor, 1, FORMAT_32);
+	report("raster.threads.1", single, "frame/s");
+	for (int threads = 2; threads <= (cores > 2 ? cores : 2); threads *= 2) {
+		char name[64];
+		double fps = benchRaster(editor, threads, FORMAT_32);
+		snprintf(name, sizeof(name), "raster.threads.%d", threads);
+		report(name, fps, "frame/s");
+		snprintf(name, sizeof(name), "raster.threads.%d.speedup", threads);
+		report(name, fps / single, "x");
 	}
+	report("raster.cores", cores, "");
+	editor->setThreads(RENDER_THREADS);
 
-	void render(Canvas *canvas) {
-		if (offset.x) {
-			scroll.x += offset.x;
-			offset.x = 0;
-		}
+#ifdef __linux__
+	benchPresent();
+#endif
 
-		if (offset.y) {
-			scroll.y += offset.y;
-			offset.y = 0;
-		}
+	benchStartup("xedit_bench.tmp", 1024 * 1024);
+	benchStartup("xedit_bench.tmp", 16 * 1024 * 1024);
+	benchStartup("xedit_bench.tmp", 256 * 1024 * 1024);
 
-		if (!valid) {
-			curBuffer ^= 1;
-			Cell *c = &cells[curBuffer ? cols * rows : 0];
-			for (int i = 0; i < cols * rows; i++) {
-				c->c		= '\0';
-				c->fColor	= COLOR_BACK_NORMAL;
-				c->bColor	= COLOR_BACK_NORMAL;
-				c->reserved	= 0;
-				c++;
-			}
-
-			Point pos = Point(scroll.x, scroll.y);
-
-			valid = true;
-			int ox = 5;
-
-			if (text) {
-				int length = strlen(text);
-				int i = 0;
-				int lexIndex = 0;
-				Syntax::Lexeme *lex = syntax.count ? &syntax.lexeme[0] : NULL;
-
-				while (i < length) {
-					if (lex && i == lex->offset) {
-						ThemeColor color = (ThemeColor)lex->id;
-						print(ox, pos.x, pos.y, color, COLOR_BACK_NORMAL, &text[lex->offset], lex->length);
-
-						i += lex->length;
-						lex = ++lexIndex == syntax.count ? NULL : &syntax.lexeme[lexIndex];
-					} else {
-						print(ox, pos.x, pos.y, COLOR_CODE, COLOR_BACK_NORMAL, &text[i], 1);
-						i++;
-					}
-				}
-			}
+	benchSearch(64 * 1024 * 1024);
+	benchLongLine();
+	benchLanguages();
 
-			print(ox, pos.x, pos.y, COLOR_CURSOR, COLOR_BACK_NORMAL, "\xDD", 1);
+	int length;
+	char *data = synthesize(8 * 1024 * 1024, length);
+	benchFile("synthetic", data, length, Editor::Syntax::Language::named("c++"));
+	free(data);
 
-			int lines = pos.y - scroll.y + 1;
-			char num[4];
-			pos = Point(0, scroll.y);
-			for (int i = 0; i < lines; i++) {
-				snprintf(num, sizeof(num), "%d", i);
-				int len = strlen(num);
-				pos.x = (3 - len);
-				print(0, pos.x, pos.y, COLOR_OPCODE, COLOR_BACK_NORMAL, num, len);
-				pos.y++;
-			}
+	for (int i = argc > 1 ? 1 : 0; i < argc; i++) {
+		const char *name = argc > 1 ? argv[i] : "main.cpp";
+		FILE *f = fopen(name, "rb");
+		if (!f) {
+			fprintf(stderr, "can't open %s\n", name);
+			continue;
+		}
+		fseek(f, 0, SEEK_END);
+		length = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		data = (char*)malloc(length);
+		fread(data, 1, length, f);
+		fclose(f);
+		benchFile(name, data, length, Editor::Syntax::Language::find(name));
+		free(data);
+	}
 
-			canvas->rect = Rect(0, 0, canvas->width, canvas->height);
+	delete editor;
+	delete font;
+	return 0;
+}
+#elif defined(XEDIT_TEST)
+#define TEST_ROUNDS	100		// texts edited per language
+#define TEST_EDITS	300		// edits of each, each one checked against a parse from scratch
+#define TEST_WHOLE	20		// edits between checks of a parse in chunks and one split among threads
 
-			//canvas->clear(theme.back_normal);
-			for (int r = 0; r < rows; r++)
-				for (int c = 0; c < cols; c++) {
-					Cell &cell = cells[c + r * cols + (curBuffer ? cols * rows : 0)];
-					Cell &last = cells[c + r * cols + (curBuffer ? 0 : cols * rows)];
+typedef Editor::Syntax Syntax;
 
-					if (cell.id != last.id) {
-						if (cell.c != '\0')
-							font->putChar(cell.c, theme.byID[cell.fColor], theme.byID[cell.bColor], &canvas->pixels[c * 9 + r * 16 * canvas->stride], canvas->stride);
-						else
-							canvas->fill(c * 9, r * 16, 9, 16, theme.byID[cell.bColor]);
+// the difference from a syntax parsed from scratch, which is reported with where it was found, false if there's none
+bool differs(const char *what, const Syntax &syntax, const Syntax &whole, const TextBuffer &text) {
+	TextBuffer::Cache cache = text.cache;
+	if (syntax.lexed != whole.lexed) {
+		fprintf(stderr, "%s: lexed up to %d, not %d\n", what, syntax.lexed, whole.lexed);
+		return true;
+	}
+	if (syntax.lexemes.count() != whole.lexemes.count()) {
+		fprintf(stderr, "%s: %d lexemes, not %d\n", what, syntax.lexemes.count(), whole.lexemes.count());
+		return true;
+	}
+	for (int i = 0; i < whole.lexemes.count(); i++) {
+		Syntax::Lexeme a = syntax.lexemes[i], b = whole.lexemes[i];
+		if (a.offset != b.offset || a.length != b.length || a.id != b.id) {
+			fprintf(stderr, "%s: lexeme %d at %d+%d of class %d, not at %d+%d of class %d\n", what, i, a.offset, a.length, a.id, b.offset, b.length, b.id);
+			return true;
+		}
+		int drawn = syntax.lexemeClass(text, i, cache), wanted = whole.lexemeClass(text, i, cache);
+		if (drawn != wanted) {
+			fprintf(stderr, "%s: lexeme %d at %d drawn in class %d, not %d\n", what, i, a.offset, drawn, wanted);
+			return true;
+		}
+	}
 
-					}
-				}
+	const Syntax::Symbols &a = syntax.symbols, &b = whole.symbols;
+	if (a.count() != b.count()) {
+		fprintf(stderr, "%s: %d definitions, not %d\n", what, a.count(), b.count());
+		return true;
+	}
+	for (int i = 0; i < b.count(); i++) {
+		const Syntax::Symbols::Name &x = a.names.items[a.name[i]], &y = b.names.items[b.name[i]];
+		if (a.offset[i] != b.offset[i] || x.length != y.length || memcmp(x.str, y.str, y.length) || a.byStatement(i) != b.byStatement(i)) {
+			fprintf(stderr, "%s: definition %d of %.*s at %d, not of %.*s at %d\n", what, i, x.length, x.str, a.offset[i], y.length, y.str, b.offset[i]);
+			return true;
+		}
+		if (a.get(x.str, x.length) != b.get(y.str, y.length)) {
+			fprintf(stderr, "%s: %.*s of class %d, not %d\n", what, y.length, y.str, a.get(x.str, x.length), b.get(y.str, y.length));
+			return true;
 		}
 	}
-};
+	return false;
+}
 
-static const Editor::Theme THEME_DARK = {
-	toColor(0xDADADA), // code
-	toColor(0xD69D85), // text
-	toColor(0x4EC9B0), // type
-	toColor(0xBD63C5), // define
-	toColor(0xB5CEA8), // number
-	toColor(0x569CD6), // opcode
-	toColor(0x57A64A), // comment
-	toColor(0x7F7F7F), // argument
-	toColor(0x000000), // back_line
-	toColor(0x1E1E1E), // back_normal
-	toColor(0x264F78), // back_selection
-	toColor(0x653306), // back_search
-	toColor(0xDCDCDC), // cursor
-};
+// edits random texts put together from the pieces of a language where lexemes and definitions begin and end,
+// in short lines or, with long, in lines of a few lexer chunks, with the syntax updated as the editor does it
+bool testLanguage(const Syntax::Language *language, bool longLines, WorkerPool *pool) {
+	static const char *pieces[] = {
+		"struct ", "typedef ", "enum ", "class ", "#define ", "int ", " Foo", " Bar", "x", ";", "{", "}", "(", ")",
+		"\n", "\r\n", "/*", "*/", "//", "\"", "'", "\\", "#", "$x", "- ", ": ", "0x1F", " ", "\t"
+	};
+	int count = sizeof(pieces) / sizeof(pieces[0]);
 
-struct Application {
-	int		width, height;
-	Canvas	*canvas;
-	Editor	*editor;
+	for (int round = 0; round < TEST_ROUNDS / (longLines ? 10 : 1); round++) {
+		int size = longLines ? 3 * LEX_CHUNK + rand() % LEX_CHUNK : rand() % 400;
+		char *data = (char*)malloc(size + 16);
+		int length = 0;
+		while (length < size) {
+			const char *str = pieces[rand() % count];
+			if (!longLines || !strpbrk(str, "\r\n"))
+				length += sprintf(&data[length], "%s", str);
+		}
+		TextBuffer text;
+		text.load(data, length);
+		Syntax syntax;
+		syntax.language = language;
+		syntax.parse(text);
 
-#ifdef WIN32
-	HWND	handle;
-	HDC		dc;
+		for (int edit = 0; edit < TEST_EDITS / (longLines ? 10 : 1); edit++) {
+			int pos = rand() % (text.length + 1);
+			if (rand() % 2) {
+				const char *str = pieces[rand() % count];
+				int len = (int)strlen(str);
+				text.insert(pos, str, len);
+				syntax.update(text, pos, 0, len);
+			} else {
+				int len = 1 + rand() % 5;
+				if (len > text.length - pos)
+					len = text.length - pos;
+				text.remove(pos, len);
+				syntax.update(text, pos, len, 0);
+			}
 
-	static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
-		Application *app = (Application*)GetWindowLong(hWnd, GWL_USERDATA);
+		// what an edit leaves unlexed is lexed by the lexer thread a chunk at a time
+			while (syntax.lexed < text.length)
+				syntax.extend(text, syntax.lexed);
 
-		switch (msg) {
-			case WM_PAINT :
-				app->paint();
-				ValidateRect(hWnd, NULL);
-				break;
-			case WM_SIZE :
-				app->resize(LOWORD(lParam), HIWORD(lParam));
-				break;
-			case WM_KEYDOWN :
-				app->editor->onKey(wParam);
-				app->invalidate();
-				break;
-			case WM_CHAR :
-				app->editor->onChar(wParam);
-				app->invalidate();
-				break;
-			case WM_MOUSEWHEEL :
-				app->editor->onScroll(0, GET_WHEEL_DELTA_WPARAM(wParam) / 120);
-				app->invalidate();
-				break;
-			case WM_LBUTTONDOWN : 
-			case WM_RBUTTONDOWN : {
-					int x = GET_X_LPARAM(lParam);
-					int y = GET_Y_LPARAM(lParam);
-				}
-				break;
-			case WM_DESTROY :
-				app->close();
-				break;
-			default :
-				return DefWindowProc(hWnd, msg, wParam, lParam);
+			char what[128];
+			snprintf(what, sizeof(what), "%s, %s, edit %d of round %d", language->name, longLines ? "long lines" : "short lines", edit, round);
+			Syntax whole;
+			whole.language = language;
+			whole.parse(text);
+			if (differs(what, syntax, whole, text))
+				return false;
+
+			if (edit % TEST_WHOLE)
+				continue;
+			Syntax chunks;
+			chunks.language = language;
+			chunks.reset();
+			while (chunks.lexed < text.length)
+				chunks.extend(text, chunks.lexed + rand() % (2 * LEX_CHUNK), pool);
+			Syntax split;
+			split.language = language;
+			split.parse(text, pool);
+			if (differs(what, chunks, whole, text) || differs(what, split, whole, text))
+				return false;
 		}
-		return 0;
 	}
-#endif
+	return true;
+}
 
-#ifdef __linux__
+// ./xedit_test.elf [seed], exits with 1 at the first difference
+int main(int argc, char **argv) {
+	int seed = argc > 1 ? atoi(argv[1]) : (int)time(NULL);
+	printf("seed %d\n", seed);
+	fflush(stdout);
+	srand(seed);
+	WorkerPool *pool = new WorkerPool(3);
+	for (const Syntax::Language *language = Syntax::Language::all(); language; language = language->next)
+		for (int longLines = 0; longLines < 2; longLines++)
+			if (!testLanguage(language, longLines != 0, pool)) {
+				delete pool;
+				return 1;
+			}
+	printf("ok\n");
+	delete pool;
+	return 0;
+}
+#elif defined(XEDIT_LATENCY)
+#define LATENCY_SETTLE	0.5		// seconds before a run, for the frames of the last one to go out
+#define LATENCY_KEY		0.030	// seconds between two typed keys, and between two key repeats
+#define LATENCY_WHEEL	0.008	// seconds between two wheel clicks of a fling
+
+enum {
+	RUN_TYPING,		// bursts of a typed line with a pause after each
+	RUN_REPEAT,		// down arrow and then backspace held at the key repeat rate
+	RUN_FLING,		// bursts of wheel clicks down and back up
+	RUN_COUNT
+};
+
+const char *runNames[RUN_COUNT] = { "typing", "repeat", "fling" };
+
+// plays the runs through XTest on a connection of its own the way a user would, then closes the window
+struct Driver {
 	Display	*display;
 	Window	window;
-	Atom	WM_DELETE_WINDOW;
-#endif
+	double	next;		// when the next event is due
 
-	Application(int width, int height) : width(width), height(height) {
-	#ifdef WIN32
-		canvas = new Canvas();
-		editor = new Editor(THEME_DARK);
-
-		handle = CreateWindow("static", "xedit", WS_OVERLAPPEDWINDOW, 0, 0, width, height, NULL, NULL, NULL, NULL);
-		dc = GetDC(handle);
-		SetWindowLong(handle, GWL_USERDATA, (LONG)this);
-		SetWindowLong(handle, GWL_WNDPROC, (LONG)&WndProc);
-		ShowWindow(handle, SW_SHOWDEFAULT);
-	#endif
-	
-	#ifdef __linux__
+	Driver(Window window) : window(window) {
 		display = XOpenDisplay(NULL);
-		if (!display) {
-			printf("can't connect to X server\n");
-			return;
-		}		
-		Window root = DefaultRootWindow(display);
-		int screen = DefaultScreen(display);
-		
-		XSetWindowAttributes attr;
-		attr.event_mask = ExposureMask | PointerMotionMask | ButtonPressMask | KeyPressMask | StructureNotifyMask | FocusChangeMask;		
-
-		window = XCreateWindow(display, root, 0, 0, width, height, 0, 0, InputOutput, NULL, CWEventMask, &attr);
-					
-		XMapWindow(display, window);
-		XSync(display, false);
-		
-		XStoreName(display, window, "xedit");
-		WM_DELETE_WINDOW = XInternAtom(display, "WM_DELETE_WINDOW", false);
-		XSetWMProtocols(display, window, &WM_DELETE_WINDOW, 1);
-		
-		canvas = new Canvas(display);
-		editor = new Editor(THEME_DARK);
-		resize(800, 600);
-	#endif
 	}
 
-	~Application() {
-		delete editor;
-		delete canvas;
-	#ifdef WIN32
-		ReleaseDC(handle, dc);
-		DestroyWindow(handle);
-	#endif
-	
-	#ifdef __linux__
-		XDestroyWindow(display, window);
+	~Driver() {
 		XCloseDisplay(display);
-	#endif
 	}
 
-	void close() {
-	#ifdef WIN32
-		PostQuitMessage(0);
-	#endif
+	// events go out on a fixed schedule, a slow frame doesn't slow down the user
+	void at(double delay) {
+		next += delay;
+		double wait = next - getTime();
+		if (wait > 0.0)
+			usleep((int)(wait * 1000000));
 	}
 
-	void invalidate() {
-	#ifdef WIN32
-		InvalidateRect(handle, NULL, false);
-	#endif
-	
-	#ifdef __linux__
-		XClearArea(display, window, 0, 0, width, height, True);
-	#endif	
+	void settle() {
+		next = getTime();
+		at(LATENCY_SETTLE);
 	}
 
-	void resize(int width, int height) {
-		editor->resize(width, height);
-		canvas->resize(editor->cols * 9, editor->rows * 16);
+	void key(int kind, KeySym sym) {
+		KeyCode code = XKeysymToKeycode(display, sym);
+		latency.send(kind);
+		XTestFakeKeyEvent(display, code, true, CurrentTime);
+		XTestFakeKeyEvent(display, code, false, CurrentTime);
+		XFlush(display);
 	}
 
-	void loop() {
-	#ifdef WIN32
-		MSG msg;
-		while (GetMessage(&msg, 0, 0, 0)) {
-			TranslateMessage(&msg);
-			DispatchMessage(&msg);			
+	void wheel(int kind, int button) {
+		latency.send(kind);
+		XTestFakeButtonEvent(display, button, true, CurrentTime);
+		XTestFakeButtonEvent(display, button, false, CurrentTime);
+		XFlush(display);
+	}
+
+	void run() {
+	// focus and pointer on the window once it's up, there's no window manager to do it
+		XWindowAttributes attr;
+		do {
+			usleep(10000);
+			XGetWindowAttributes(display, window, &attr);
+		} while (attr.map_state != IsViewable);
+		int x, y;
+		Window child;
+		XTranslateCoordinates(display, window, DefaultRootWindow(display), attr.width / 2, attr.height / 2, &x, &y, &child);
+		XSetInputFocus(display, window, RevertToParent, CurrentTime);
+		XTestFakeMotionEvent(display, DefaultScreen(display), x, y, CurrentTime);
+		XSync(display, false);
+
+		settle();
+		const char *line = "value = x - 1;";
+		for (int burst = 0; burst < 8; burst++) {
+			for (const char *c = line; *c; c++) {
+				key(RUN_TYPING, (KeySym)(unsigned char)*c);
+				at(LATENCY_KEY);
+			}
+			key(RUN_TYPING, XK_Return);
+			at(0.4);
 		}
-	#endif
-	
-	#ifdef __linux__
-		XEvent e;
-		bool quit = false;
-		while (!quit) {
-			XNextEvent(display, &e);
-			switch (e.type) {
-				case FocusIn:
-					invalidate();
-					paint();
-				break;
-				case ButtonPress :
-					if (e.xbutton.button == 4)	editor->onScroll(0, +1);
-					if (e.xbutton.button == 5)	editor->onScroll(0, -1);
-					invalidate();
-					break;				
-				case MotionNotify :
-				//	printf("mouse: %d %d\n", e.xmotion.x, e.xmotion.y);
-				//	offset = e.xmotion.y;
-				//	draw(display, window, DefaultGC(display, screen));
-					break;
-				case KeyPress: {
-					//	printf("key: %d %d\n", e.xkey.state, e.xkey.keycode);
-						char c;
-						if (e.xkey.keycode != VK_BACK &&
-							XLookupString(&e.xkey, &c, 1, NULL, NULL)) {
-							editor->onChar(c);
-						//	printf("char %d %d\n", len, (int));
-						} else
-							editor->onKey(e.xkey.keycode);
-						invalidate();
-					}
-					break;
-				case ConfigureNotify : {
-						width	= e.xconfigure.width;
-						height	= e.xconfigure.height;
-						resize(width, height);
-					}
-					break;
-				case Expose :
-					paint();
-					break;
-				case ClientMessage :
-					if ((Atom)e.xclient.data.l[0] == WM_DELETE_WINDOW)
-						quit = true;
-					break;					
+
+		settle();
+		for (int i = 0; i < 120; i++) {
+			key(RUN_REPEAT, i < 60 ? XK_Down : XK_BackSpace);
+			at(LATENCY_KEY);
+		}
+
+		settle();
+		for (int burst = 0; burst < 8; burst++) {
+			for (int i = 0; i < 12; i++) {
+				wheel(RUN_FLING, burst & 1 ? 4 : 5);
+				at(LATENCY_WHEEL);
 			}
-			
-		}	
-	#endif
-	}
+			at(0.3);
+		}
 
-	void paint() {
-		editor->render(canvas);
-	#ifdef WIN32
-		canvas->present(dc);
-	#endif
-	#ifdef __linux__
-		canvas->present(window);
-	#endif
+		settle();
+		XEvent e;
+		memset(&e, 0, sizeof(e));
+		e.xclient.type			= ClientMessage;
+		e.xclient.window		= window;
+		e.xclient.message_type	= XInternAtom(display, "WM_PROTOCOLS", false);
+		e.xclient.format		= 32;
+		e.xclient.data.l[0]		= XInternAtom(display, "WM_DELETE_WINDOW", false);
+		XSendEvent(display, window, false, NoEventMask, &e);
+		XSync(display, false);
 	}
 };
 
-int main() {
+int compareTimes(const void *a, const void *b) {
+	double d = *(const double*)a - *(const double*)b;
+	return d < 0.0 ? -1 : d > 0.0 ? 1 : 0;
+}
+
+// p50, p99 and max of n times in seconds, reported in milliseconds
+void reportTimes(const char *prefix, const char *name, double *times, int n) {
+	char buf[64];
+	qsort(times, n, sizeof(double), compareTimes);
+	snprintf(buf, sizeof(buf), "%s.p50", name);
+	report(prefix, buf, times[(n - 1) / 2] * 1000.0, "ms");
+	snprintf(buf, sizeof(buf), "%s.p99", name);
+	report(prefix, buf, times[(n * 99 + 99) / 100 - 1] * 1000.0, "ms");
+	snprintf(buf, sizeof(buf), "%s.max", name);
+	report(prefix, buf, times[n - 1] * 1000.0, "ms");
+}
+
+// the editor in a window of its own with the driver playing the runs into it,
+// input is arrival to handled, total is arrival to shown and queue is sent to arrival
+void benchLatency(const char *name, const char *label) {
+	latency.clear();
+	Application *app = new Application(800, 600, name);
+	Driver *driver = new Driver(app->window);
+	std::thread thread(&Driver::run, driver);
+	app->loop();
+	thread.join();
+	delete driver;
+	delete app;
+
+	double *input = new double[latency.count], *total = new double[latency.count], *queue = new double[latency.count];
+	for (int kind = 0; kind < RUN_COUNT; kind++) {
+		int n = 0;
+		for (int i = 0; i < latency.count; i++) {
+			const Latency::Event &event = latency.events[i];
+			if (event.kind != kind || event.shown == 0.0)
+				continue;
+			input[n]	= event.handled - event.arrived;
+			total[n]	= event.shown - event.arrived;
+			queue[n]	= event.arrived - event.sent;
+			n++;
+		}
+		char prefix[128];
+		snprintf(prefix, sizeof(prefix), "latency.%s.%s", label, runNames[kind]);
+		report(prefix, "events", n, "");
+		if (!n)
+			continue;
+		reportTimes(prefix, "input", input, n);
+		reportTimes(prefix, "total", total, n);
+		reportTimes(prefix, "queue", queue, n);
+	}
+	delete[] input;
+	delete[] total;
+	delete[] queue;
+}
+
+int main(int argc, char **argv) {
+	Display *display = XOpenDisplay(NULL);
+	if (!display) {
+		fprintf(stderr, "can't connect to X server\n");
+		return 1;
+	}
+	int event, error, major, minor;
+	bool test = XTestQueryExtension(display, &event, &error, &major, &minor);
+	XCloseDisplay(display);
+	if (!test) {
+		fprintf(stderr, "no XTest extension on the server\n");
+		return 1;
+	}
+
+	for (int i = argc > 1 ? 1 : 0; i < argc; i++) {
+		const char *name = argc > 1 ? argv[i] : "main.cpp";
+		benchLatency(name, name);
+	}
+
+	int length;
+	char *data = synthesize(256 * 1024 * 1024, length);
+	FILE *f = fopen("xedit_latency.tmp", "wb");
+	fwrite(data, 1, length, f);
+	fclose(f);
+	free(data);
+	benchLatency("xedit_latency.tmp", "huge");
+	remove("xedit_latency.tmp");
+	return 0;
+}
+#else
+int main(int argc, char **argv) {
 //	convertFont("font.tga", "font.dat");
-	Application *app = new Application(800, 600);
+	Application *app = new Application(800, 600, argc > 1 ? argv[1] : "main.cpp");
+	if (const char *threads = getenv("XEDIT_THREADS"))
+		app->editor->setThreads(atoi(threads));
+#ifdef __linux__
+	if (const char *fps = getenv("XEDIT_FPS"))
+		app->setFrameRate(atoi(fps));
+	if (const char *shm = getenv("XEDIT_SHM")) {
+		app->canvas->setShared(atoi(shm) != 0);
+		app->editor->redraw();
+	}
+#endif
 	app->loop();
 	delete app;
+#ifdef XEDIT_PROFILE
+	if (const char *trace = getenv("XEDIT_TRACE"))
+		if (!profiler.write(trace))
+			printf("can't write %s\n", trace);
+#endif
 	return 0;
 };
+#endif